@@ -1,13 +1,156 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include <stdexcept>
 #include "backend.hpp"
 #include "simulator.hpp"
 #include "ucaspian.hpp"
+#include "dvs.hpp"
 
 namespace py = pybind11;
 namespace csp = caspian;
 
+/* Calls which only touch native state drop the GIL so independent simulators can run from
+ * separate Python threads (see the threading notes in the README) */
+using release_gil = py::call_guard<py::gil_scoped_release>;
+
+/* Results come back as numpy arrays without per-element conversion. Arrays made from a
+ * vector own it (released by a capsule with the last reference to the array), so they stay
+ * valid forever. Views onto simulator memory keep the simulator object alive but are only
+ * valid until its next simulate, update, clear_activity, reset, or configure call. */
+template <typename T>
+static py::array_t<T> to_numpy(std::vector<T> &&v)
+{
+    auto *owned = new std::vector<T>(std::move(v));
+
+    py::capsule free_when_done(owned, [](void *f) {
+        delete reinterpret_cast<std::vector<T>*>(f);
+    });
+
+    return py::array_t<T>({owned->size()}, {sizeof(T)}, owned->data(), free_when_done);
+}
+
+/* read-only view of simulator memory, base keeps the owner alive */
+template <typename T>
+static py::array_t<T> view_numpy(const std::vector<T> &v, py::handle base)
+{
+    py::array_t<T> a({v.size()}, {sizeof(T)}, v.data(), base);
+    a.attr("setflags")(false);
+    return a;
+}
+
+/* (ids, offsets, nets) of the recorded spikes, copied or as views */
+static py::tuple spike_buffer_arrays(csp::Backend &dev, bool copy)
+{
+    const csp::SpikeBuffer &sb = dev.get_spike_buffer();
+
+    if(!copy)
+    {
+        py::object self = py::cast(&dev, py::return_value_policy::reference);
+        return py::make_tuple(view_numpy(sb.ids, self), view_numpy(sb.offsets, self), view_numpy(sb.nets, self));
+    }
+
+    std::vector<uint32_t> ids, nets;
+    std::vector<size_t> offsets;
+    {
+        py::gil_scoped_release release;
+        ids = sb.ids;
+        offsets = sb.offsets;
+        nets = sb.nets;
+    }
+
+    return py::make_tuple(to_numpy(std::move(ids)), to_numpy(std::move(offsets)), to_numpy(std::move(nets)));
+}
+
+typedef py::array_t<int32_t, py::array::c_style | py::array::forcecast> dvs_coords;
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> dvs_times;
+
+/* event arrays must be flat and of matching length (p only with polarity) */
+static void check_dvs_events(const csp::DvsConverter &conv, const dvs_coords &x, const dvs_coords &y,
+                             const dvs_coords &p, const dvs_times &t, const char *func)
+{
+    const bool need_p = conv.config().use_polarity;
+
+    if(x.ndim() != 1 || y.ndim() != 1 || t.ndim() != 1 || x.size() != y.size() || y.size() != t.size() ||
+       (need_p && (p.ndim() != 1 || p.size() != t.size())))
+        throw std::runtime_error(std::string("[") + func + "] x, y, p, and t must be flat with matching length");
+}
+
+/* checks the event arrays and runs the conversion without the GIL */
+static size_t apply_dvs(csp::DvsConverter &conv, csp::Backend *dev, const dvs_coords &x, const dvs_coords &y,
+                        const dvs_coords &p, const dvs_times &t, int network_id)
+{
+    const bool need_p = conv.config().use_polarity;
+    check_dvs_events(conv, x, y, p, t, "apply_dvs_events");
+
+    const int32_t *xp = x.data();
+    const int32_t *yp = y.data();
+    const int32_t *pp = need_p ? p.data() : nullptr;
+    const double *tp = t.data();
+    size_t n = t.size();
+
+    py::gil_scoped_release release;
+    return conv.apply(dev, xp, yp, pp, tp, n, network_id);
+}
+
+/* A layout is "nmnist" or a dict with header, record_size, time_scale, and x/y/p/t dicts
+ * of offset, bytes, shift, bits, and big_endian */
+static csp::DvsLayout parse_dvs_layout(const py::object &o)
+{
+    if(py::isinstance<py::str>(o))
+    {
+        std::string name = o.cast<std::string>();
+        if(name == "nmnist") return csp::DvsLayout::nmnist();
+        throw std::invalid_argument("[DvsFile] Unknown layout preset '" + name + "'");
+    }
+
+    py::dict d = o.cast<py::dict>();
+    csp::DvsLayout l;
+
+    auto field = [&](const char *name, csp::DvsField &f) {
+        if(!d.contains(name)) return;
+        py::dict fd = d[name].cast<py::dict>();
+        if(fd.contains("offset")) f.offset = fd["offset"].cast<uint32_t>();
+        if(fd.contains("bytes")) f.bytes = fd["bytes"].cast<uint32_t>();
+        if(fd.contains("shift")) f.shift = fd["shift"].cast<uint32_t>();
+        if(fd.contains("bits")) f.bits = fd["bits"].cast<uint32_t>();
+        if(fd.contains("big_endian")) f.big_endian = fd["big_endian"].cast<bool>();
+    };
+
+    if(d.contains("header")) l.header = d["header"].cast<size_t>();
+    if(d.contains("record_size")) l.record_size = d["record_size"].cast<size_t>();
+    if(d.contains("time_scale")) l.time_scale = d["time_scale"].cast<double>();
+    field("x", l.x);
+    field("y", l.y);
+    field("p", l.p);
+    field("t", l.t);
+
+    return l;
+}
+
+/* (times, ids) of every output fire, sorted by output */
+template <typename Dev>
+static py::tuple output_spike_data(Dev &sim)
+{
+    std::vector<int> times, ids;
+
+    {
+        py::gil_scoped_release release;
+        int i = 0;
+
+        while(sim.get_output_count(i) >= 0) {
+            auto outputs = sim.get_output_values(i);
+            for(auto out : outputs) {
+                times.push_back(out);
+                ids.push_back(i);
+            }
+            i++;
+        }
+    }
+
+    return py::make_tuple(to_numpy(std::move(times)), to_numpy(std::move(ids)));
+}
+
 void bind_backend(py::module &m) {
     /* Simulator/Device Bindings
      *   Device, SimDevice, etc.
@@ -17,6 +160,10 @@ void bind_backend(py::module &m) {
             (void (csp::Backend::*)(int,int16_t,uint64_t)) &csp::Backend::apply_input,
             py::arg("input_id"), py::arg("charge"), py::arg("t")
         )
+        .def("apply_input", 
+            (void (csp::Backend::*)(int,int16_t,uint64_t,int)) &csp::Backend::apply_input,
+            py::arg("input_id"), py::arg("charge"), py::arg("t"), py::arg("network_id")
+        )
 
         .def("set_debug", &csp::Backend::set_debug)
 
@@ -52,59 +199,106 @@ void bind_backend(py::module &m) {
             }
         })
 
-        .def("apply_dvs_events", 
-        [](csp::Backend &dev,
-           const std::vector<int> x, 
-           const std::vector<int> y, 
-           const std::vector<int> p, 
-           const std::vector<double> t, 
-           std::pair<int,int> dims,
-           bool use_polarity) {
-
-            // error check
-            if(x.size() != y.size() || y.size() != t.size() || (use_polarity && t.size() != p.size())) {
-                throw std::runtime_error("[apply_dvs_events] x, y, p, and t must have matching length");
-            }
+        /* Flat numpy arrays of input ids, charges, and times -- queued in one native call */
+        .def("apply_inputs", [](csp::Backend &dev,
+                                py::array_t<int, py::array::c_style | py::array::forcecast> ids,
+                                py::array_t<int16_t, py::array::c_style | py::array::forcecast> charges,
+                                py::array_t<uint64_t, py::array::c_style | py::array::forcecast> times,
+                                int network_id) {
+            if(ids.ndim() != 1 || charges.ndim() != 1 || times.ndim() != 1 ||
+               ids.size() != charges.size() || ids.size() != times.size())
+                throw std::invalid_argument("[apply_inputs] ids, charges, and times must be 1-d arrays of matching length");
 
-            // Value: caspian::constants::MAX_DEVICE_INPUT
-            
-            uint32_t max_x, max_y;
-            std::tie(max_x, max_y) = dims;
-            uint32_t frame_size = max_x * max_y;
+            const int *id_ptr = ids.data();
+            const int16_t *w_ptr = charges.data();
+            const uint64_t *t_ptr = times.data();
+            size_t count = ids.size();
 
-            // Generate and immediately apply spikes
-            for(size_t i = 0; i < x.size(); ++i)
-            {
-                auto nid = y[i] * max_x + x[i];
-                if(use_polarity) nid += p[i] * frame_size;
-                dev.apply_input(nid, caspian::constants::MAX_DEVICE_INPUT, uint64_t(floor(t[i])));
-            }
+            py::gil_scoped_release release;
+            dev.apply_inputs(id_ptr, w_ptr, t_ptr, count, network_id);
+        }, py::arg("ids"), py::arg("charges"), py::arg("times"), py::arg("network_id") = -1)
+
+        /* DVS events as numpy arrays (see DvsConverter for the mapping) -- converted
+         * natively and queued through the bulk input path */
+        .def("apply_dvs_events",
+        [](csp::Backend &dev, dvs_coords x, dvs_coords y, dvs_coords p, dvs_times t,
+           std::pair<uint32_t,uint32_t> dims, bool use_polarity, double time_bin, uint32_t downsample,
+           uint64_t refractory, int network_id) {
+            csp::DvsConfig cfg;
+            std::tie(cfg.width, cfg.height) = dims;
+            cfg.use_polarity = use_polarity;
+            cfg.time_bin = time_bin;
+            cfg.downsample = downsample;
+            cfg.refractory = refractory;
+
+            csp::DvsConverter conv(cfg);
+            return apply_dvs(conv, &dev, x, y, p, t, network_id);
 
-        }, py::arg("x"), py::arg("y"), py::arg("p"), py::arg("t"), py::arg("dims"), py::arg("use_polarity") = true)
+        }, py::arg("x"), py::arg("y"), py::arg("p"), py::arg("t"), py::arg("dims"), py::arg("use_polarity") = true,
+           py::arg("time_bin") = 1.0, py::arg("downsample") = 1, py::arg("refractory") = 0, py::arg("network_id") = -1)
 
         .def("collect_all_spikes", &csp::Backend::collect_all_spikes, py::arg("collect") = true)
-        .def("get_all_spikes", &csp::Backend::get_all_spikes)
+        /* A list with an array of fired neuron ids for every cycle of the last run. The
+         * arrays are views into a single owned copy of the flat spike buffer. */
+        .def("get_all_spikes", [](csp::Backend &dev) {
+            const csp::SpikeBuffer &sb = dev.get_spike_buffer();
+            py::array_t<uint32_t> ids = to_numpy(std::vector<uint32_t>(sb.ids));
+            const uint32_t *base = ids.data();
 
-        .def("configure", &csp::Backend::configure)
-        .def("configure_multi", &csp::Backend::configure_multi)
-        .def("simulate", &csp::Backend::simulate)
-        .def("update", &csp::Backend::update)
+            py::list cycles;
+            for(size_t t = 0; t < sb.cycles(); t++)
+                cycles.append(py::array_t<uint32_t>({sb.end(t) - sb.offsets[t]}, {sizeof(uint32_t)},
+                                                    base + sb.offsets[t], ids));
+            return cycles;
+        })
+
+        /* The flat spike buffer of the last run as (ids, offsets, nets): the spikes of cycle t
+         * are ids[offsets[t]:offsets[t+1]], nets is only filled for a batch of networks. With
+         * copy=False these are read-only views (see to_numpy above for their lifetime). */
+        .def("get_spike_buffer", &spike_buffer_arrays, py::arg("copy") = true)
+
+        /* (times, ids) of every recorded spike of the last run, e.g. for a raster plot */
+        .def("get_spike_raster", [](csp::Backend &dev) {
+            std::vector<uint32_t> times, ids;
+
+            {
+                py::gil_scoped_release release;
+                const csp::SpikeBuffer &sb = dev.get_spike_buffer();
+
+                ids = sb.ids;
+                times.resize(ids.size());
+                for(size_t t = 0; t < sb.cycles(); t++)
+                    std::fill(times.begin() + sb.offsets[t], times.begin() + sb.end(t), t);
+            }
+
+            return py::make_tuple(to_numpy(std::move(times)), to_numpy(std::move(ids)));
+        })
+
+        .def("configure", &csp::Backend::configure, release_gil())
+        .def("configure_multi", &csp::Backend::configure_multi, release_gil())
+        .def("simulate", &csp::Backend::simulate, release_gil())
+        .def("update", &csp::Backend::update, release_gil())
         .def("get_metric", &csp::Backend::get_metric)
+        .def("get_network_metric", &csp::Backend::get_network_metric, py::arg("metric"), py::arg("network_id") = 0)
         .def("get_time", &csp::Backend::get_time)
-        .def("reset", &csp::Backend::reset)
-        .def("clear_activity", &csp::Backend::clear_activity)
+        .def("reset", &csp::Backend::reset, release_gil())
+        .def("clear_activity", &csp::Backend::clear_activity, release_gil())
         .def("track_aftertime", &csp::Backend::track_aftertime, py::arg("output_id"), py::arg("aftertime"))
         .def("track_timing", &csp::Backend::track_timing, py::arg("output_id"), py::arg("do_tracking") = true)
         .def("get_output_count", &csp::Backend::get_output_count, py::arg("output_id"), py::arg("network_id") = 0)
         .def("get_last_output_time", &csp::Backend::get_last_output_time, py::arg("output_id"), py::arg("network_id") = 0)
         .def("get_all_output_counts", [](csp::Backend &dev, int n_outputs, int network_id) {
-            std::vector<int> outputs(n_outputs);
+            py::array_t<int> outputs(n_outputs);
+            int *out = outputs.mutable_data();
+
+            py::gil_scoped_release release;
             for(int i = 0; i < n_outputs; ++i) {
-                outputs[i] = dev.get_output_count(i, network_id);
+                out[i] = dev.get_output_count(i, network_id);
             }
             return outputs;
         }, py::arg("n_outputs"), py::arg("network_id") = 0)
         .def("get_output_max_count", [](csp::Backend &dev, int n_outputs, int network_id) {
+            py::gil_scoped_release release;
             int max_idx = 0;
             int max_val = 0;
 
@@ -118,26 +312,94 @@ void bind_backend(py::module &m) {
 
             return std::make_tuple(max_idx, max_val);
         }, py::arg("n_outputs"), py::arg("network_id") = 0)
-        .def("get_outputs", &csp::Backend::get_output_values, py::arg("output_id"), py::arg("network_id") = 0);
+        .def("get_outputs", [](csp::Backend &dev, uint32_t output_id, int network_id) {
+            std::vector<uint32_t> values;
+            {
+                py::gil_scoped_release release;
+                values = dev.get_output_values(output_id, network_id);
+            }
+            return to_numpy(std::move(values));
+        }, py::arg("output_id"), py::arg("network_id") = 0);
+
+    /* Stateful converter for DVS streams fed in chunks (the refractory state carries over) */
+    py::class_<csp::DvsConverter>(m, "DvsConverter")
+        .def(py::init([](std::pair<uint32_t,uint32_t> dims, bool use_polarity, double time_bin, double time_offset,
+                         uint32_t downsample, uint64_t refractory, int16_t charge) {
+            csp::DvsConfig cfg;
+            std::tie(cfg.width, cfg.height) = dims;
+            cfg.use_polarity = use_polarity;
+            cfg.time_bin = time_bin;
+            cfg.time_offset = time_offset;
+            cfg.downsample = downsample;
+            cfg.refractory = refractory;
+            cfg.charge = charge;
+            return new csp::DvsConverter(cfg);
+        }), py::arg("dims"), py::arg("use_polarity") = true, py::arg("time_bin") = 1.0, py::arg("time_offset") = 0.0,
+            py::arg("downsample") = 1, py::arg("refractory") = 0, py::arg("charge") = csp::constants::MAX_DEVICE_INPUT)
+
+        .def_property_readonly("num_inputs", &csp::DvsConverter::num_inputs)
+        .def("reset", &csp::DvsConverter::reset)
+
+        /* (ids, charges, times) numpy arrays */
+        .def("convert", [](csp::DvsConverter &conv, dvs_coords x, dvs_coords y, dvs_coords p, dvs_times t) {
+            check_dvs_events(conv, x, y, p, t, "convert");
+
+            std::vector<int> ids;
+            std::vector<int16_t> charges;
+            std::vector<uint64_t> times;
+            const int32_t *pp = conv.config().use_polarity ? p.data() : nullptr;
+
+            {
+                py::gil_scoped_release release;
+                conv.convert(x.data(), y.data(), pp, t.data(), t.size(), ids, charges, times);
+            }
+
+            return py::make_tuple(to_numpy(std::move(ids)), to_numpy(std::move(charges)), to_numpy(std::move(times)));
+        }, py::arg("x"), py::arg("y"), py::arg("p"), py::arg("t"))
+
+        /* converts and injects, returns the number of events kept */
+        .def("apply", [](csp::DvsConverter &conv, csp::Backend &dev, dvs_coords x, dvs_coords y, dvs_coords p,
+                         dvs_times t, int network_id) {
+            return apply_dvs(conv, &dev, x, y, p, t, network_id);
+        }, py::arg("backend"), py::arg("x"), py::arg("y"), py::arg("p"), py::arg("t"), py::arg("network_id") = -1);
+
+    /* Memory-mapped event file, replayed window by window through a DvsConverter */
+    py::class_<csp::DvsFile>(m, "DvsFile")
+        .def(py::init([](const std::string &path, const py::object &layout) {
+            return new csp::DvsFile(path, parse_dvs_layout(layout));
+        }), py::arg("path"), py::arg("layout") = "nmnist")
+
+        .def("__len__", &csp::DvsFile::size)
+        .def("time", &csp::DvsFile::time, py::arg("index"))
+        .def("find", &csp::DvsFile::find, py::arg("t"))
+
+        /* (x, y, p, t) numpy arrays of events [begin, end) */
+        .def("read", [](const csp::DvsFile &f, size_t begin, size_t end) {
+            end = std::min(end, f.size());
+            begin = std::min(begin, end);
+            py::ssize_t n = end - begin;
+
+            py::array_t<int32_t> x(n), y(n), p(n);
+            py::array_t<double> t(n);
+            int32_t *xp = x.mutable_data(), *yp = y.mutable_data(), *pp = p.mutable_data();
+            double *tp = t.mutable_data();
+
+            {
+                py::gil_scoped_release release;
+                f.read(begin, end, xp, yp, pp, tp);
+            }
+
+            return py::make_tuple(x, y, p, t);
+        }, py::arg("begin"), py::arg("end"))
+
+        .def("apply_window", &csp::DvsFile::apply_window,
+                py::arg("converter"), py::arg("backend"), py::arg("t0"), py::arg("t1"), py::arg("network_id") = -1,
+                release_gil());
 
     py::class_<csp::Simulator, csp::Backend>(m, "Simulator")
         .def(py::init<bool>(), py::arg("debug") = false)
         
-        .def("spike_data", [](csp::Simulator &sim) {
-            std::vector<int> times, ids;
-            int i = 0;
-
-            while(sim.get_output_count(i) >= 0) {
-                auto outputs = sim.get_output_values(i);
-                for(auto out : outputs) {
-                    times.push_back(out);
-                    ids.push_back(i);
-                }
-                i++;
-            }
-
-            return std::make_pair(times, ids);
-        });
+        .def("spike_data", &output_spike_data<csp::Simulator>);
 
 #ifdef WITH_USB
     py::class_<csp::UsbCaspian, csp::Backend>(m, "UsbCaspian")
@@ -148,21 +410,7 @@ void bind_backend(py::module &m) {
         })
 
 
-        .def("spike_data", [](csp::UsbCaspian &sim) {
-            std::vector<int> times, ids;
-            int i = 0;
-
-            while(sim.get_output_count(i) >= 0) {
-                auto outputs = sim.get_output_values(i);
-                for(auto out : outputs) {
-                    times.push_back(out);
-                    ids.push_back(i);
-                }
-                i++;
-            }
-
-            return std::make_pair(times, ids);
-        });
+        .def("spike_data", &output_spike_data<csp::UsbCaspian>);
 #endif
         
 }
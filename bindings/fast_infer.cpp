@@ -18,51 +18,361 @@
 
 #include "framework.hpp"
 #include "processor.hpp"
+#include "network_conversion.hpp"
+#include "worker_pool.hpp"
 #include "concurrentqueue.h"
 
 #include <vector>
-#include <thread>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <map>
+#include <string>
 
 using namespace neuro;
 namespace py = pybind11;
 
 using moodycamel::ConcurrentQueue;
 
-struct WorkerData
+/* Evaluation results are cached by the structure of the network (after conversion), the
+ * processor configuration, the dataset, the number of timesteps, and the decoder. EONS frequently produces
+ * networks which were already evaluated (clones, reverted mutations), and those can skip
+ * simulation entirely. The caller identifies the dataset with an integer id -- the cache is
+ * only used when one is given. */
+struct EvalKey
 {
-    WorkerData(std::vector<Network*>& networks_, const nlohmann::json &config_, int steps_) : 
-        networks(networks_), processor_config(config_), num_steps(steps_)
+    uint64_t net_hash;
+    uint64_t config_hash;
+    int64_t dataset_id;
+    int num_steps;
+    uint64_t decoder_hash;
+
+    bool operator==(const EvalKey &k) const
     {
-        results = nullptr;
-        scores = nullptr;
-        actual = nullptr;
+        return net_hash == k.net_hash && config_hash == k.config_hash &&
+               dataset_id == k.dataset_id && num_steps == k.num_steps &&
+               decoder_hash == k.decoder_hash;
     }
+};
 
-    ConcurrentQueue<size_t> queue; // queue of network ids to process
-    std::vector<Network*>& networks; // reference to a listing of networks to process
-    std::vector<std::vector<Spike>> encoded_data; // only encode data once and allow all threads to read
-    const nlohmann::json& processor_config; // 
-    std::vector<int> *actual; // labels
-    int *results; // 2-d array of prediction results
-    double *scores; // 1-d array of accuracies
-    int num_steps; // number of timesteps for each sample
+struct EvalKeyHash
+{
+    size_t operator()(const EvalKey &k) const
+    {
+        // the network hash is already well mixed
+        return k.net_hash ^ (k.config_hash * 31) ^ (uint64_t(k.dataset_id) << 20) ^ uint64_t(k.num_steps) ^
+               (k.decoder_hash * 17);
+    }
 };
 
-void predict(caspian::Processor &p, Network *net, std::vector<std::vector<Spike>>& spikes, int num_steps, int* ret)
+class EvalCache
 {
-    p.load_network(net);
+public:
+    /* Copies the cached predictions for samples [begin, end) into ret if the key is present.
+     * With an order, the samples are order[begin] up to order[end]. */
+    bool lookup(const EvalKey &key, int *ret, size_t num_samples, size_t begin, size_t end,
+                const uint32_t *order = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto it = index.find(key);
+        if(it == index.end() || it->second->second.size() != num_samples)
+        {
+            misses++;
+            return false;
+        }
+
+        // move to the front (most recently used)
+        lru.splice(lru.begin(), lru, it->second);
+        const std::vector<int> &cached = it->second->second;
 
-    // Predict each sample by iterating through the encoded data vector (spikes)
-    for(size_t sample = 0; sample < spikes.size(); sample++)
+        if(order == nullptr)
+            std::copy(cached.begin() + begin, cached.begin() + end, ret + begin);
+        else
+            for(size_t i = begin; i < end; i++) ret[order[i]] = cached[order[i]];
+
+        hits++;
+        return true;
+    }
+
+    void insert(const EvalKey &key, const int *predictions, size_t num_samples)
     {
-        // Apply spikes and simulate
-        p.apply_spikes(spikes[sample]);
-        p.run(num_steps);
+        std::lock_guard<std::mutex> lock(mtx);
 
-        // Gather results
+        if(capacity == 0) return;
+
+        auto it = index.find(key);
+        if(it != index.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            it->second->second.assign(predictions, predictions + num_samples);
+            return;
+        }
+
+        lru.emplace_front(key, std::vector<int>(predictions, predictions + num_samples));
+        index.emplace(key, lru.begin());
+        evict();
+    }
+
+    void set_capacity(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        capacity = n;
+        evict();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        lru.clear();
+        index.clear();
+        hits = 0;
+        misses = 0;
+    }
+
+    py::dict info()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        py::dict d;
+        d["size"] = lru.size();
+        d["capacity"] = capacity;
+        d["hits"] = hits;
+        d["misses"] = misses;
+        return d;
+    }
+
+private:
+    void evict()
+    {
+        while(lru.size() > capacity)
+        {
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+
+    typedef std::list<std::pair<EvalKey, std::vector<int>>> LruList;
+
+    std::mutex mtx;
+    size_t capacity = 4096;
+    size_t hits = 0;
+    size_t misses = 0;
+    LruList lru;
+    std::unordered_map<EvalKey, LruList::iterator, EvalKeyHash> index;
+};
+
+static EvalCache eval_cache;
+
+/* Measured evaluation time per sample of recently seen networks, keyed by the framework
+ * content fingerprint (with the processor configuration and timesteps mixed in). This is
+ * only a scheduling hint, so the table is simply emptied when it fills up. Networks which
+ * were never timed are estimated from their size and the average time per element of the
+ * networks which were. */
+class RuntimeHistory
+{
+public:
+    /* expected seconds per sample */
+    double expected(uint64_t key, double size)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto it = history.find(key);
+        if(it != history.end()) return it->second;
+
+        return size * ((total_size > 0) ? total_time / total_size : 1e-6);
+    }
+
+    void record(uint64_t key, double size, double seconds_per_sample)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if(history.size() >= capacity) history.clear();
+
+        // smooth over repeated evaluations of the same network
+        auto it = history.find(key);
+        if(it == history.end())
+            history.emplace(key, seconds_per_sample);
+        else
+            it->second = 0.5 * (it->second + seconds_per_sample);
+
+        total_time += seconds_per_sample;
+        total_size += size;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        history.clear();
+        total_time = 0;
+        total_size = 0;
+    }
+
+private:
+    std::mutex mtx;
+    size_t capacity = 1 << 16;
+    std::unordered_map<uint64_t, double> history;
+    double total_time = 0; // sums over every recorded evaluation
+    double total_size = 0;
+};
+
+static RuntimeHistory runtime_history;
+
+/* Every encoded sample in one flat array -- the spikes of sample i are
+ * spikes[offsets[i]] up to spikes[offsets[i+1]] */
+struct EncodedData
+{
+    std::vector<Spike> spikes;
+    std::vector<size_t> offsets = {0};
+
+    size_t size() const { return offsets.size() - 1; }
+    const Spike* sample(size_t i) const { return spikes.data() + offsets[i]; }
+    size_t count(size_t i) const { return offsets[i+1] - offsets[i]; }
+
+    void clear()
+    {
+        spikes.clear();
+        offsets.assign(1, 0);
+    }
+};
+
+/* Turns the output activity of one simulated sample into a result. Label decoders produce
+ * a single class per sample (these can be scored and cached); feature decoders write a fixed
+ * number of values per sample. */
+class Decoder
+{
+public:
+    virtual ~Decoder() = default;
+
+    /* true if decode() produces a class label */
+    virtual bool is_label() const { return false; }
+
+    /* number of values written per sample */
+    virtual size_t width(size_t num_outputs) const { (void) num_outputs; return 1; }
+
+    /* called after a network is loaded -- turns on any output tracking needed */
+    virtual void prepare(caspian::Processor &p, size_t num_outputs) const { (void) p; (void) num_outputs; }
+
+    /* reads the outputs of the last run into out[0 .. width) */
+    virtual void decode(caspian::Processor &p, size_t num_outputs, int num_steps, double *out) const = 0;
+
+    /* the configuration this decoder was made from (part of the evaluation cache key) */
+    nlohmann::json config;
+};
+
+class LabelDecoder : public Decoder
+{
+public:
+    bool is_label() const override { return true; }
+
+    void decode(caspian::Processor &p, size_t num_outputs, int num_steps, double *out) const override
+    {
+        (void) num_steps;
+        *out = label(p, num_outputs);
+    }
+
+    /* -1 means no class was chosen */
+    virtual int label(caspian::Processor &p, size_t num_outputs) const = 0;
+};
+
+/* How a winner is chosen when several outputs tie */
+enum class TiePolicy { Lowest, Highest, None, FirstSpike };
+
+static TiePolicy parse_tie_policy(const nlohmann::json &j)
+{
+    std::string s = j.value("tie_policy", "lowest");
+
+    if(s == "lowest") return TiePolicy::Lowest;
+    if(s == "highest") return TiePolicy::Highest;
+    if(s == "none") return TiePolicy::None;
+    if(s == "first_spike") return TiePolicy::FirstSpike;
+
+    throw std::invalid_argument("[decoder] Unknown tie_policy \"" + s + "\" (lowest, highest, none, first_spike)");
+}
+
+static void track_all_outputs(caspian::Processor &p, size_t num_outputs)
+{
+    for(size_t oid = 0; oid < num_outputs; oid++)
+        p.track_output(oid, true);
+}
+
+/* time of the first fire of an output (tracking must be on), -1 if it never fired */
+static double first_fire(caspian::Processor &p, size_t oid)
+{
+    std::vector<double> times = p.output_vector(oid);
+    return times.empty() ? -1 : times[0];
+}
+
+/* Picks the output with the largest value -- values of -1 never win */
+static int pick_winner(const std::vector<double> &vals, bool largest, TiePolicy policy, caspian::Processor &p)
+{
+    int best = -1;
+    bool tied = false;
+
+    for(size_t oid = 0; oid < vals.size(); oid++)
+    {
+        if(vals[oid] < 0) continue;
+
+        if(best < 0 || (largest ? vals[oid] > vals[best] : vals[oid] < vals[best]))
+        {
+            best = oid;
+            tied = false;
+        }
+        else if(vals[oid] == vals[best])
+        {
+            tied = true;
+            if(policy == TiePolicy::Highest) best = oid;
+        }
+    }
+
+    if(!tied || best < 0) return best;
+
+    switch(policy)
+    {
+        case TiePolicy::None:
+            return -1;
+
+        case TiePolicy::FirstSpike:
+        {
+            // earliest first fire among the tied outputs, then the lowest id
+            int winner = -1;
+            double t_win = -1;
+
+            for(size_t oid = 0; oid < vals.size(); oid++)
+            {
+                if(vals[oid] != vals[best]) continue;
+
+                double t = first_fire(p, oid);
+                if(t >= 0 && (winner < 0 || t < t_win))
+                {
+                    winner = oid;
+                    t_win = t;
+                }
+            }
+
+            return (winner < 0) ? best : winner;
+        }
+
+        default:
+            return best;
+    }
+}
+
+/* The original behaviour: most output spikes, lowest id on a tie, 0 if nothing fired */
+class ArgmaxDecoder : public LabelDecoder
+{
+public:
+    int label(caspian::Processor &p, size_t num_outputs) const override
+    {
         int idx = 0, cnt = 0;
-        for(size_t oid = 0; oid < net->num_outputs(); oid++)
+
+        for(size_t oid = 0; oid < num_outputs; oid++)
         {
             int c = p.output_count(oid);
             if(c > cnt)
@@ -72,8 +382,186 @@ void predict(caspian::Processor &p, Network *net, std::vector<std::vector<Spike>
             }
         }
 
-        // Currently just doing argmax of spike count. In the future, this should accept a decoder object.
-        ret[sample] = idx;
+        return idx;
+    }
+};
+
+/* Most output spikes with a configurable tie policy, -1 if nothing fired */
+class WinnerDecoder : public LabelDecoder
+{
+public:
+    explicit WinnerDecoder(const nlohmann::json &j) : policy(parse_tie_policy(j)) {}
+
+    void prepare(caspian::Processor &p, size_t num_outputs) const override
+    {
+        if(policy == TiePolicy::FirstSpike) track_all_outputs(p, num_outputs);
+    }
+
+    int label(caspian::Processor &p, size_t num_outputs) const override
+    {
+        std::vector<double> counts(num_outputs);
+        for(size_t oid = 0; oid < num_outputs; oid++)
+            counts[oid] = p.output_count(oid);
+
+        // silent outputs can not win
+        for(auto &c : counts) if(c == 0) c = -1;
+
+        return pick_winner(counts, true, policy, p);
+    }
+
+private:
+    TiePolicy policy;
+};
+
+/* The output which fired first, -1 if nothing fired */
+class FirstToSpikeDecoder : public LabelDecoder
+{
+public:
+    explicit FirstToSpikeDecoder(const nlohmann::json &j) : policy(parse_tie_policy(j))
+    {
+        // ties are already on the first spike
+        if(policy == TiePolicy::FirstSpike) policy = TiePolicy::Lowest;
+    }
+
+    void prepare(caspian::Processor &p, size_t num_outputs) const override
+    {
+        track_all_outputs(p, num_outputs);
+    }
+
+    int label(caspian::Processor &p, size_t num_outputs) const override
+    {
+        std::vector<double> times(num_outputs);
+        for(size_t oid = 0; oid < num_outputs; oid++)
+            times[oid] = first_fire(p, oid);
+
+        return pick_winner(times, false, policy, p);
+    }
+
+private:
+    TiePolicy policy;
+};
+
+/* Last fire time of every output (-1 if it never fired) */
+class LastFireDecoder : public Decoder
+{
+public:
+    size_t width(size_t num_outputs) const override { return num_outputs; }
+
+    void decode(caspian::Processor &p, size_t num_outputs, int num_steps, double *out) const override
+    {
+        (void) num_steps;
+        for(size_t oid = 0; oid < num_outputs; oid++)
+            out[oid] = p.output_last_fire(oid);
+    }
+};
+
+/* Spike count of every output divided by the number of timesteps */
+class RateDecoder : public Decoder
+{
+public:
+    size_t width(size_t num_outputs) const override { return num_outputs; }
+
+    void decode(caspian::Processor &p, size_t num_outputs, int num_steps, double *out) const override
+    {
+        for(size_t oid = 0; oid < num_outputs; oid++)
+            out[oid] = (num_steps > 0) ? double(p.output_count(oid)) / num_steps : 0;
+    }
+};
+
+/* The first max_spikes fire times of every output, padded with -1 */
+class SpikeTimesDecoder : public Decoder
+{
+public:
+    explicit SpikeTimesDecoder(const nlohmann::json &j) : max_spikes(j.value("max_spikes", 1))
+    {
+        if(max_spikes <= 0)
+            throw std::invalid_argument("[decoder] spike_times needs max_spikes > 0");
+    }
+
+    size_t width(size_t num_outputs) const override { return num_outputs * max_spikes; }
+
+    void prepare(caspian::Processor &p, size_t num_outputs) const override
+    {
+        track_all_outputs(p, num_outputs);
+    }
+
+    void decode(caspian::Processor &p, size_t num_outputs, int num_steps, double *out) const override
+    {
+        (void) num_steps;
+        for(size_t oid = 0; oid < num_outputs; oid++)
+        {
+            std::vector<double> times = p.output_vector(oid);
+            size_t n = std::min<size_t>(times.size(), max_spikes);
+
+            std::copy(times.begin(), times.begin() + n, out);
+            std::fill(out + n, out + max_spikes, -1.0);
+            out += max_spikes;
+        }
+    }
+
+private:
+    int max_spikes;
+};
+
+typedef std::function<std::unique_ptr<Decoder>(const nlohmann::json&)> DecoderFactory;
+
+/* Decoders by name. Native decoders are added by inserting a factory here. */
+static std::map<std::string, DecoderFactory>& decoder_registry()
+{
+    static std::map<std::string, DecoderFactory> registry = {
+        {"argmax", [](const nlohmann::json &) { return std::unique_ptr<Decoder>(new ArgmaxDecoder()); }},
+        {"winner", [](const nlohmann::json &j) { return std::unique_ptr<Decoder>(new WinnerDecoder(j)); }},
+        {"first_to_spike", [](const nlohmann::json &j) { return std::unique_ptr<Decoder>(new FirstToSpikeDecoder(j)); }},
+        {"last_fire", [](const nlohmann::json &) { return std::unique_ptr<Decoder>(new LastFireDecoder()); }},
+        {"rate", [](const nlohmann::json &) { return std::unique_ptr<Decoder>(new RateDecoder()); }},
+        {"spike_times", [](const nlohmann::json &j) { return std::unique_ptr<Decoder>(new SpikeTimesDecoder(j)); }}
+    };
+
+    return registry;
+}
+
+/* j is either a decoder name or an object with a "name" and the decoder's options */
+std::unique_ptr<Decoder> make_decoder(const nlohmann::json &j)
+{
+    nlohmann::json cfg = j.is_string() ? nlohmann::json{{"name", j}} : j;
+
+    if(!cfg.is_object() || !cfg.contains("name") || !cfg["name"].is_string())
+        throw std::invalid_argument("[decoder] Expected a decoder name or an object with a \"name\"");
+
+    std::string name = cfg["name"];
+    auto it = decoder_registry().find(name);
+    if(it == decoder_registry().end())
+        throw std::invalid_argument("[decoder] Unknown decoder \"" + name + "\"");
+
+    std::unique_ptr<Decoder> dec = it->second(cfg);
+    dec->config = cfg;
+    return dec;
+}
+
+/* Predicts samples [begin, end) (or order[begin] up to order[end]) with the network already
+ * loaded on the processor. Label decoders write labels[sample], feature decoders write
+ * features[sample * width ..]. */
+void predict_range(caspian::Processor &p, const Decoder &dec, size_t num_outputs, const EncodedData &data,
+                   int num_steps, int *labels, double *features, size_t begin, size_t end,
+                   const uint32_t *order = nullptr)
+{
+    const size_t width = dec.width(num_outputs);
+    const LabelDecoder *label_dec = dec.is_label() ? static_cast<const LabelDecoder*>(&dec) : nullptr;
+
+    // Predict each sample by iterating through the encoded data
+    for(size_t i = begin; i < end; i++)
+    {
+        size_t sample = (order != nullptr) ? order[i] : i;
+
+        // Apply spikes and simulate
+        p.apply_spikes(data.sample(sample), data.count(sample));
+        p.run(num_steps);
+
+        // Gather results
+        if(label_dec != nullptr)
+            labels[sample] = label_dec->label(p, num_outputs);
+        else
+            dec.decode(p, num_outputs, num_steps, &(features[sample * width]));
 
         // Clear before next sample
         p.clear_activity();
@@ -99,141 +587,605 @@ void score(int *predictions, std::vector<int>& y, size_t num, double *score)
     *score = static_cast<double>(correct) / static_cast<double>(num);
 }
 
-void pool_worker(WorkerData *info)
+/* Owns everything an evaluation needs besides the networks: a persistent pool of worker
+ * threads, one processor per worker, and the encoded dataset. EONS evaluates every
+ * generation on the same data, so keeping a context alive across generations removes the
+ * thread start-up, processor construction, and encoding from each call. */
+class EvalContext
 {
-    size_t id;
-    size_t r_stride = info->encoded_data.size();
+public:
+    EvalContext(const nlohmann::json &config, int num_threads) :
+        processor_config(config), pool(num_threads)
+    {
+        config_hash = std::hash<std::string>()(config.dump());
 
-    auto processor = caspian::Processor(info->processor_config);
+        for(int i = 0; i < pool.size(); i++)
+            processors.emplace_back(new caspian::Processor(processor_config));
+    }
 
-    // keep popping network ids off the queue until everything is processed
-    while(info->queue.try_dequeue(id))
+    /* Encodes the dataset once; it stays resident until the next call */
+    void set_data(EncoderArray *encoder, py::array_t<double, py::array::c_style | py::array::forcecast> data,
+                  const std::vector<int> &y, int64_t dataset_id)
     {
-        predict(processor, 
-                info->networks[id], 
-                info->encoded_data, 
-                info->num_steps, 
-                &(info->results[id * r_stride]));
+        if(data.ndim() != 2)
+            throw std::invalid_argument("[set_data] data must be a 2-d array of samples");
+
+        const double *rows = data.data();
+        const size_t n_rows = data.shape(0);
+        const size_t n_cols = data.shape(1);
+
+        // every worker encodes with its own copy of the encoder
+        nlohmann::json encoder_json = encoder->as_json();
+
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(mtx);
+
+        encoded_data.clear();
+        labels = y;
+        data_id = dataset_id;
 
-        if(info->scores != nullptr)
+        // rows are encoded in chunks -- each chunk collects its spikes separately and the
+        // chunks are stitched together in order afterwards
+        const size_t chunk_rows = 256;
+        const size_t n_chunks = (n_rows + chunk_rows - 1) / chunk_rows;
+        std::vector<std::vector<Spike>> chunks(n_chunks);
+        std::vector<size_t> row_counts(n_rows);
+        std::atomic<size_t> next(0);
+
+        pool.run([&](int) {
+            EncoderArray enc(encoder_json);
+            std::vector<double> row(n_cols);
+            size_t c;
+
+            while((c = next.fetch_add(1)) < n_chunks)
+            {
+                size_t end = std::min(n_rows, (c + 1) * chunk_rows);
+
+                for(size_t i = c * chunk_rows; i < end; i++)
+                {
+                    // the encoder takes a vector, so each row is a single contiguous copy
+                    std::copy(rows + i * n_cols, rows + (i + 1) * n_cols, row.begin());
+
+                    std::vector<Spike> sp = enc.get_spikes(row);
+                    row_counts[i] = sp.size();
+                    chunks[c].insert(chunks[c].end(), sp.begin(), sp.end());
+                }
+            }
+        });
+
+        encoded_data.offsets.resize(n_rows + 1);
+        for(size_t i = 0; i < n_rows; i++)
+            encoded_data.offsets[i+1] = encoded_data.offsets[i] + row_counts[i];
+
+        encoded_data.spikes.reserve(encoded_data.offsets.back());
+        for(auto &chunk : chunks)
         {
-            score(&(info->results[id * r_stride]),
-                  *(info->actual),
-                  info->encoded_data.size(),
-                  &(info->scores[id]));
+            encoded_data.spikes.insert(encoded_data.spikes.end(), chunk.begin(), chunk.end());
+            std::vector<Spike>().swap(chunk);
         }
     }
-}
-
-void encode(WorkerData *info, py::array_t<double>& data, EncoderArray *encoder)
-{
-    // Encode into spikes
-    auto d = data.unchecked<2>();
 
-    std::vector<double> dp(d.shape(1));
-    for(size_t i = 0; i < d.shape(0); i++)
+    /* Label decoders give a (networks x samples) int array, feature decoders a
+     * (networks x samples x width) double array */
+    py::array predict(const std::vector<Network*> &networks, int num_steps, const nlohmann::json &decoder)
     {
-        // Right now, the data must be copied into a vector piece by piece to pass to the encoder
-        for(size_t k = 0; k < d.shape(1); k++)
+        std::unique_ptr<Decoder> dec = make_decoder(decoder);
+        const size_t n_samples = encoded_data.size();
+
+        if(dec->is_label())
         {
-            dp[k] = d(i, k);
+            int *results = new int[networks.size() * n_samples];
+
+            py::capsule free_when_done(results, [](void *f) {
+                int *ptr = reinterpret_cast<int *>(f);
+                delete[] ptr;
+            });
+
+            evaluate(networks, num_steps, *dec, results, nullptr, nullptr);
+
+            // return buffer of the predictions (basically like a numpy ndarray)
+            return py::array_t<int>(
+                {networks.size(), n_samples}, // shape
+                {sizeof(int) * n_samples, sizeof(int)}, // strides
+                results, // data ptr
+                free_when_done); // deallocator object
         }
 
-        info->encoded_data.push_back(encoder->get_spikes(dp));
+        const size_t width = feature_width(networks, *dec);
+        double *results = new double[networks.size() * n_samples * width];
+
+        py::capsule free_when_done(results, [](void *f) {
+            double *ptr = reinterpret_cast<double *>(f);
+            delete[] ptr;
+        });
+
+        evaluate(networks, num_steps, *dec, nullptr, results, nullptr);
+
+        return py::array_t<double>(
+            {networks.size(), n_samples, width}, // shape
+            {sizeof(double) * n_samples * width, sizeof(double) * width, sizeof(double)}, // strides
+            results, // data ptr
+            free_when_done); // deallocator object
     }
-}
 
-void run_pool(WorkerData *info, int num_threads)
-{
-    // Fill queue
-    for(size_t i = 0; i < info->networks.size(); i++)
+    py::array_t<double> accuracy(const std::vector<Network*> &networks, int num_steps, const nlohmann::json &decoder)
     {
-        info->queue.enqueue(i);
+        std::unique_ptr<Decoder> dec = make_decoder(decoder);
+        if(!dec->is_label())
+            throw std::invalid_argument("[accuracy] Decoder " + dec->config.dump() + " does not produce class labels");
+
+        std::vector<int> results(networks.size() * encoded_data.size());
+        double *scores = new double[networks.size()];
+
+        // The accuracy scores will be returned as a Python buffer to avoid a copy, so 
+        // we need to tell Python how to deallocate the buffer when done
+        py::capsule free_when_done(scores, [](void *f) {
+            double *ptr = reinterpret_cast<double *>(f);
+            delete[] ptr;
+        });
+
+        evaluate(networks, num_steps, *dec, results.data(), nullptr, scores);
+
+        // return buffer of the scores (basically like a numpy array)
+        return py::array_t<double>(
+            {networks.size()}, // shape
+            {sizeof(double)}, // strides
+            scores, // data ptr
+            free_when_done); // deallocator object
     }
 
-    // Launch worker threads
-    std::vector<std::thread> threads;
-    for(size_t i = 0; i < num_threads; i++)
+    /* Like accuracy(), but a network is dropped as soon as it can not reach the target
+     * accuracy, or a Hoeffding bound puts it below the target with probability 1 - delta.
+     * Returns the scores (accuracy on the samples seen for a dropped network) and a flag for
+     * every dropped network. */
+    py::tuple accuracy_race(const std::vector<Network*> &networks, int num_steps, double target,
+                            double delta, const nlohmann::json &decoder, uint64_t seed)
     {
-        threads.emplace_back(pool_worker, info);
+        std::unique_ptr<Decoder> dec = make_decoder(decoder);
+        if(!dec->is_label())
+            throw std::invalid_argument("[accuracy_race] Decoder " + dec->config.dump() + " does not produce class labels");
+        if(labels.size() != encoded_data.size())
+            throw std::invalid_argument("[accuracy_race] Racing needs a label for every sample");
+        if(delta <= 0 || delta >= 1)
+            throw std::invalid_argument("[accuracy_race] delta must be in (0, 1)");
+
+        std::vector<int> results(networks.size() * encoded_data.size());
+        double *scores = new double[networks.size()];
+        bool *aborted = new bool[networks.size()];
+
+        py::capsule free_scores(scores, [](void *f) {
+            double *ptr = reinterpret_cast<double *>(f);
+            delete[] ptr;
+        });
+
+        py::capsule free_aborted(aborted, [](void *f) {
+            bool *ptr = reinterpret_cast<bool *>(f);
+            delete[] ptr;
+        });
+
+        Race race = {target, delta, seed, aborted};
+        evaluate(networks, num_steps, *dec, results.data(), nullptr, scores, &race);
+
+        return py::make_tuple(
+            py::array_t<double>({networks.size()}, {sizeof(double)}, scores, free_scores),
+            py::array_t<bool>({networks.size()}, {sizeof(bool)}, aborted, free_aborted));
     }
 
-    // Wait for completion
-    for(size_t i = 0; i < threads.size(); i++)
+    /* Runs one network over every sample and returns the spike count of each neuron in
+     * num_bins equal time bins as a (samples x neurons x bins) array, with the neurons in
+     * the order of Processor::neuron_counts. Meant as the features of a trained readout. */
+    py::array_t<int> features(Network *network, int num_steps, size_t num_bins)
     {
-        threads[i].join();
+        if(num_bins == 0 || num_steps <= 0)
+            throw std::invalid_argument("[features] num_bins and num_steps must be positive");
+
+        size_t n_samples, n_neurons, stride;
+        int *results;
+
+        // the lock is dropped before the GIL is taken back
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mtx);
+
+            n_samples = encoded_data.size();
+
+            // every worker loads the network once, which also gives the neuron count
+            processors[0]->load_network(network);
+            n_neurons = processors[0]->num_readout_neurons();
+            stride = n_neurons * num_bins;
+
+            results = new int[std::max<size_t>(1, n_samples * stride)];
+
+            const size_t chunk = 16;
+            std::atomic<size_t> next(0);
+
+            try
+            {
+                pool.run([&](int worker) {
+                    caspian::Processor &p = *processors[worker];
+                    caspian::Backend *dev = p.get_backend();
+
+                    if(worker != 0) p.load_network(network);
+                    dev->collect_all_spikes(true);
+
+                    size_t b;
+                    while((b = next.fetch_add(chunk)) < n_samples)
+                    {
+                        size_t end = std::min(n_samples, b + chunk);
+
+                        for(size_t sample = b; sample < end; sample++)
+                        {
+                            p.apply_spikes(encoded_data.sample(sample), encoded_data.count(sample));
+                            p.run(num_steps);
+                            p.read_neuron_bins(&(results[sample * stride]), num_bins, num_steps);
+                            p.clear_activity();
+                        }
+                    }
+
+                    // recording every spike slows the other evaluations down
+                    dev->collect_all_spikes(false);
+                });
+            }
+            catch(...)
+            {
+                for(auto &p : processors) p->get_backend()->collect_all_spikes(false);
+                delete[] results;
+                throw;
+            }
+        }
+
+        py::capsule free_when_done(results, [](void *f) {
+            int *ptr = reinterpret_cast<int *>(f);
+            delete[] ptr;
+        });
+
+        return py::array_t<int>(
+            {n_samples, n_neurons, num_bins}, // shape
+            {sizeof(int) * stride, sizeof(int) * num_bins, sizeof(int)}, // strides
+            results, // data ptr
+            free_when_done); // deallocator object
     }
-}
 
-py::array_t<double> score_all_pool(const nlohmann::json &j, EncoderArray *encoder,
-        std::vector<Network*> networks, py::array_t<double>data, std::vector<int> y, int num_steps, int num_threads)
-{
-    auto info = std::make_unique<WorkerData>(networks, j, num_steps);
+    /* Seconds spent on each network during the last evaluation (summed over its tiles) */
+    py::array_t<double> last_times()
+    {
+        std::vector<double> times;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mtx);
+            times = net_times;
+        }
+        return py::array_t<double>(times.size(), times.data());
+    }
 
-    // encode all the data to spikes
-    encode(info.get(), data, encoder);
+    size_t num_samples() const { return encoded_data.size(); }
+    int num_threads() const { return pool.size(); }
 
-    // Allocate results array
-    const int results_size = networks.size() * info->encoded_data.size();
-    info->results = new int[results_size];
-    info->scores = new double[networks.size()];
-    info->actual = &y;
+private:
+    /* Racing parameters, aborted is filled with one flag per network */
+    struct Race
+    {
+        double target;
+        double delta;
+        uint64_t seed;
+        bool *aborted;
+    };
 
-    // The accuracy scores will be returned as a Python buffer to avoid a copy, so 
-    // we need to tell Python how to deallocate the buffer when done
-    py::capsule free_when_done(info->scores, [](void *f) {
-        double *ptr = reinterpret_cast<double *>(f);
-        delete[] ptr;
-    });
+    /* A unit of work: a range of samples for one network */
+    struct Tile
+    {
+        size_t net;
+        size_t begin;
+        size_t end;
+    };
 
-    run_pool(info.get(), num_threads);
+    /* features are only stacked into one array if every network has the same outputs */
+    static size_t feature_width(const std::vector<Network*> &networks, const Decoder &dec)
+    {
+        if(networks.empty()) return dec.width(0);
 
-    // delete the results; we don't need them
-    delete[] info->results;
+        size_t n_outputs = networks[0]->num_outputs();
+        for(Network *net : networks)
+            if(net->num_outputs() != n_outputs)
+                throw std::invalid_argument("[predict] Feature decoders need networks with the same number of outputs");
 
-    // return buffer of the scores (basically like a numpy array)
-    return py::array_t<double>(
-        {networks.size()}, // shape
-        {sizeof(double)}, // strides
-        info->scores, // data ptr
-        free_when_done); // deallocator object
-}
+        return dec.width(n_outputs);
+    }
+
+    /* Label decoders fill the (networks x samples) labels, feature decoders the
+     * (networks x samples x width) features; scores is optional and needs labels. With a
+     * race, networks which fall behind the target are abandoned part way through. */
+    void evaluate(const std::vector<Network*> &networks, int num_steps, const Decoder &dec,
+                  int *labels_out, double *features_out, double *scores, const Race *race = nullptr)
+    {
+        // the workers never touch Python objects
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(mtx);
+
+        const size_t n_samples = encoded_data.size();
+        const size_t n_nets = networks.size();
+
+        // only class labels are cached
+        const bool use_cache = (data_id >= 0 && dec.is_label());
+        const uint64_t decoder_hash = std::hash<std::string>()(dec.config.dump());
+        const size_t row = n_samples * (dec.is_label() ? 1 : feature_width(networks, dec));
+
+        // Networks are split into sample ranges until there are a few tiles per worker, so
+        // a handful of networks still occupies every core. A population larger than that
+        // keeps its networks whole and each network is loaded only once.
+        const size_t target = 4 * pool.size();
+        const size_t tiles_per_net = std::max<size_t>(1, std::min(n_samples, (target + n_nets - 1) / std::max<size_t>(1, n_nets)));
+        size_t tile_samples = std::max<size_t>(1, (n_samples + tiles_per_net - 1) / tiles_per_net);
+
+        // A race checks every network after each of its tiles, so the tiles are kept small.
+        // The samples are visited in a random order so any prefix is an unbiased sample of
+        // the dataset (datasets are often sorted by class).
+        std::vector<uint32_t> order;
+        if(race != nullptr)
+        {
+            tile_samples = std::min<size_t>(tile_samples, 64);
+
+            order.resize(n_samples);
+            for(size_t i = 0; i < n_samples; i++) order[i] = i;
+            std::mt19937_64 gen(race->seed);
+            std::shuffle(order.begin(), order.end(), gen);
+        }
+        const uint32_t *sample_order = (race != nullptr) ? order.data() : nullptr;
+
+        // Longest expected first, so a large network is not the last one picked up and left
+        // running alone at the end. The size counts every neuron and every synapse (the
+        // total fan-out) since the event processing scales with both.
+        std::vector<uint64_t> history_keys(n_nets);
+        std::vector<double> sizes(n_nets);
+        std::vector<double> cost(n_nets);
+        std::atomic<size_t> next(0);
+
+        pool.run([&](int) {
+            size_t i;
+            while((i = next.fetch_add(1)) < n_nets)
+            {
+                history_keys[i] = caspian::hash_mix(caspian::network_framework_fingerprint(networks[i]) ^
+                                                    (config_hash * 31) ^ uint64_t(num_steps));
+                sizes[i] = networks[i]->num_nodes() + networks[i]->num_edges();
+                cost[i] = runtime_history.expected(history_keys[i], sizes[i]);
+            }
+        });
+
+        std::vector<size_t> dispatch(n_nets);
+        for(size_t i = 0; i < n_nets; i++) dispatch[i] = i;
+        std::stable_sort(dispatch.begin(), dispatch.end(), [&](size_t a, size_t b) { return cost[a] > cost[b]; });
+
+        // tiles of a network are queued back to back, so a worker usually takes several
+        // in a row without reloading
+        ConcurrentQueue<Tile> queue;
+        std::vector<std::atomic<size_t>> remaining(n_nets);
+
+        // race progress of each network: correct count in the high half, samples seen in
+        // the low half -- a single word so both are read consistently
+        std::vector<std::atomic<uint64_t>> progress(n_nets);
+        std::vector<std::atomic<bool>> dropped(n_nets);
+
+        // time spent on each network, and the part of it which was simulated (not cached)
+        std::vector<std::atomic<uint64_t>> nanos(n_nets);
+        std::vector<std::atomic<uint64_t>> sim_nanos(n_nets);
+        std::vector<std::atomic<uint64_t>> sim_samples(n_nets);
+
+        for(size_t i : dispatch)
+        {
+            size_t n_tiles = 0;
+            size_t b = 0;
+            do
+            {
+                queue.enqueue({i, b, std::min(n_samples, b + tile_samples)});
+                b += tile_samples;
+                n_tiles++;
+            } while(b < n_samples);
 
-py::array_t<int> predict_all_pool(const nlohmann::json &j, EncoderArray *encoder,
-        std::vector<Network*> networks, py::array_t<double>data, int num_steps, int num_threads)
+            remaining[i] = n_tiles;
+            progress[i] = 0;
+            dropped[i] = false;
+            nanos[i] = 0;
+            sim_nanos[i] = 0;
+            sim_samples[i] = 0;
+        }
+
+        // the bound is checked after every tile of a network, so delta is split over them
+        const double checks = std::max<size_t>(1, (n_samples + tile_samples - 1) / tile_samples);
+        const double log_term = (race != nullptr) ? std::log(checks / race->delta) : 0;
+
+        pool.run([&](int worker) {
+            caspian::Processor &p = *processors[worker];
+            Network *loaded = nullptr;
+            size_t n_outputs = 0;
+            EvalKey key = {0, 0, -1, 0, 0};
+            Tile t;
+
+            while(queue.try_dequeue(t))
+            {
+                int *ret = (labels_out != nullptr) ? &(labels_out[t.net * row]) : nullptr;
+                double *feat = (features_out != nullptr) ? &(features_out[t.net * row]) : nullptr;
+
+                // the remaining tiles of a dropped network are only counted off
+                if(!dropped[t.net])
+                {
+                    auto start = std::chrono::steady_clock::now();
+
+                    // only reload when the network changes
+                    if(networks[t.net] != loaded)
+                    {
+                        loaded = networks[t.net];
+                        n_outputs = loaded->num_outputs();
+                        p.load_network(loaded);
+                        dec.prepare(p, n_outputs);
+
+                        if(use_cache)
+                            key = {p.get_internal_network(0)->structural_hash(), config_hash, data_id, num_steps, decoder_hash};
+                    }
+
+                    bool simulated = !use_cache || !eval_cache.lookup(key, ret, n_samples, t.begin, t.end, sample_order);
+                    if(simulated)
+                        predict_range(p, dec, n_outputs, encoded_data, num_steps, ret, feat, t.begin, t.end, sample_order);
+
+                    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start).count();
+                    nanos[t.net] += elapsed;
+                    if(simulated)
+                    {
+                        sim_nanos[t.net] += elapsed;
+                        sim_samples[t.net] += t.end - t.begin;
+                    }
+
+                    if(race != nullptr)
+                    {
+                        uint64_t correct = 0;
+                        for(size_t i = t.begin; i < t.end; i++)
+                            if(ret[order[i]] == labels[order[i]]) correct++;
+
+                        uint64_t prog = progress[t.net].fetch_add((correct << 32) | (t.end - t.begin)) +
+                                        ((correct << 32) | (t.end - t.begin));
+                        double right = prog >> 32;
+                        double seen = prog & 0xffffffff;
+
+                        // can not reach the target even if every remaining sample is right
+                        if(right + (n_samples - seen) < race->target * n_samples)
+                            dropped[t.net] = true;
+
+                        // the true accuracy is below right/seen + eps with probability 1 - delta/checks
+                        else if(seen < n_samples && right / seen + std::sqrt(log_term / (2 * seen)) < race->target)
+                            dropped[t.net] = true;
+                    }
+                }
+
+                // whoever finishes the last tile of a network reduces its results
+                if(remaining[t.net].fetch_sub(1) == 1)
+                {
+                    if(race != nullptr)
+                    {
+                        uint64_t prog = progress[t.net];
+                        uint64_t seen = prog & 0xffffffff;
+
+                        race->aborted[t.net] = dropped[t.net];
+                        if(scores != nullptr)
+                            scores[t.net] = (seen > 0) ? double(prog >> 32) / seen : 0;
+                    }
+                    else if(scores != nullptr)
+                        score(ret, labels, n_samples, &(scores[t.net]));
+
+                    // partial results are not cached
+                    if(use_cache && !dropped[t.net])
+                        eval_cache.insert(key, ret, n_samples);
+
+                    if(sim_samples[t.net] > 0)
+                        runtime_history.record(history_keys[t.net], sizes[t.net], 1e-9 * sim_nanos[t.net] / sim_samples[t.net]);
+                }
+            }
+        });
+
+        net_times.resize(n_nets);
+        for(size_t i = 0; i < n_nets; i++)
+            net_times[i] = 1e-9 * nanos[i];
+    }
+
+    nlohmann::json processor_config;
+    uint64_t config_hash; // processor configuration component of the cache key
+    caspian::WorkerPool pool;
+    std::vector<std::unique_ptr<caspian::Processor>> processors; // one per worker
+    EncodedData encoded_data; // only encode data once and allow all threads to read
+    std::vector<int> labels;
+    int64_t data_id = -1; // identifies the dataset for the evaluation cache (-1 => no caching)
+    std::vector<double> net_times; // seconds per network of the last evaluation
+    std::mutex mtx; // one evaluation (or data update) at a time
+};
+
+py::object score_all_pool(const nlohmann::json &j, EncoderArray *encoder,
+        std::vector<Network*> networks, py::array_t<double, py::array::c_style | py::array::forcecast> data, std::vector<int> y, int num_steps, int num_threads,
+        int64_t dataset_id, const nlohmann::json &decoder, bool return_times)
 {
-    auto info = std::make_unique<WorkerData>(networks, j, num_steps);
+    EvalContext ctx(j, num_threads);
+    ctx.set_data(encoder, data, y, dataset_id);
+    py::array_t<double> scores = ctx.accuracy(networks, num_steps, decoder);
 
-    // encode all the data to spikes
-    encode(info.get(), data, encoder);
+    if(return_times) return py::make_tuple(scores, ctx.last_times());
+    return std::move(scores);
+}
 
-    // Allocate results array
-    const int results_size = networks.size() * info->encoded_data.size();
-    info->results = new int[results_size];
+py::tuple race_all_pool(const nlohmann::json &j, EncoderArray *encoder,
+        std::vector<Network*> networks, py::array_t<double, py::array::c_style | py::array::forcecast> data, std::vector<int> y, int num_steps,
+        double target, int num_threads, int64_t dataset_id, const nlohmann::json &decoder, double delta, uint64_t seed,
+        bool return_times)
+{
+    EvalContext ctx(j, num_threads);
+    ctx.set_data(encoder, data, y, dataset_id);
+    py::tuple ret = ctx.accuracy_race(networks, num_steps, target, delta, decoder, seed);
 
-    py::capsule free_when_done(info->results, [](void *f) {
-        int *ptr = reinterpret_cast<int *>(f);
-        delete[] ptr;
-    });
+    if(return_times) return py::make_tuple(ret[0], ret[1], ctx.last_times());
+    return ret;
+}
 
-    run_pool(info.get(), num_threads);
+py::array_t<int> features_all_pool(const nlohmann::json &j, EncoderArray *encoder, Network *network,
+        py::array_t<double, py::array::c_style | py::array::forcecast> data, int num_steps, size_t num_bins, int num_threads)
+{
+    EvalContext ctx(j, num_threads);
+    ctx.set_data(encoder, data, {}, -1);
+    return ctx.features(network, num_steps, num_bins);
+}
 
-    // return buffer of the predictions (basically like a numpy ndarray)
-    return py::array_t<int>(
-        {networks.size(), info->encoded_data.size()}, // shape
-        {sizeof(int) * info->encoded_data.size(), sizeof(int)}, // strides
-        info->results, // data ptr
-        free_when_done); // deallocator object
+py::object predict_all_pool(const nlohmann::json &j, EncoderArray *encoder,
+        std::vector<Network*> networks, py::array_t<double, py::array::c_style | py::array::forcecast> data, int num_steps, int num_threads,
+        int64_t dataset_id, const nlohmann::json &decoder, bool return_times)
+{
+    EvalContext ctx(j, num_threads);
+    ctx.set_data(encoder, data, {}, dataset_id);
+    py::array results = ctx.predict(networks, num_steps, decoder);
+
+    if(return_times) return py::make_tuple(results, ctx.last_times());
+    return std::move(results);
 }
 
 
 void bind_fast_infer(py::module &m)
 {
+    py::class_<EvalContext>(m, "EvalContext")
+        .def(py::init<const nlohmann::json&, int>(), py::arg("proc_config"), py::arg("num_threads") = 4)
+        .def("set_data", &EvalContext::set_data,
+                py::arg("encoder"), py::arg("data"), py::arg("y") = std::vector<int>(), py::arg("dataset_id") = -1)
+        .def("predict", &EvalContext::predict, py::arg("networks"), py::arg("num_steps"), py::arg("decoder") = "argmax")
+        .def("accuracy", &EvalContext::accuracy, py::arg("networks"), py::arg("num_steps"), py::arg("decoder") = "argmax")
+        .def("accuracy_race", &EvalContext::accuracy_race, py::arg("networks"), py::arg("num_steps"), py::arg("target"),
+                py::arg("delta") = 0.05, py::arg("decoder") = "argmax", py::arg("seed") = 0)
+        .def("features", &EvalContext::features, py::arg("network"), py::arg("num_steps"), py::arg("bins") = 1)
+        .def_property_readonly("last_times", &EvalContext::last_times)
+        .def_property_readonly("num_samples", &EvalContext::num_samples)
+        .def_property_readonly("num_threads", &EvalContext::num_threads);
+
     m.def("fast_predict", &predict_all_pool,
             py::arg("proc_config"), py::arg("encoder"), py::arg("networks"),
-            py::arg("data"), py::arg("num_steps"), py::arg("num_threads") = 4);
+            py::arg("data"), py::arg("num_steps"), py::arg("num_threads") = 4,
+            py::arg("dataset_id") = -1, py::arg("decoder") = "argmax", py::arg("return_times") = false);
 
     m.def("fast_accuracy", &score_all_pool,
             py::arg("proc_config"), py::arg("encoder"), py::arg("networks"),
-            py::arg("data"), py::arg("y"), py::arg("num_steps"), py::arg("num_threads") = 4);
+            py::arg("data"), py::arg("y"), py::arg("num_steps"), py::arg("num_threads") = 4,
+            py::arg("dataset_id") = -1, py::arg("decoder") = "argmax", py::arg("return_times") = false);
+
+    m.def("fast_accuracy_race", &race_all_pool,
+            py::arg("proc_config"), py::arg("encoder"), py::arg("networks"),
+            py::arg("data"), py::arg("y"), py::arg("num_steps"), py::arg("target"), py::arg("num_threads") = 4,
+            py::arg("dataset_id") = -1, py::arg("decoder") = "argmax", py::arg("delta") = 0.05, py::arg("seed") = 0,
+            py::arg("return_times") = false);
+
+    m.def("fast_features", &features_all_pool,
+            py::arg("proc_config"), py::arg("encoder"), py::arg("network"),
+            py::arg("data"), py::arg("num_steps"), py::arg("bins") = 1, py::arg("num_threads") = 4);
+
+    m.def("decoders", []() {
+        std::vector<std::string> names;
+        for(auto const &d : decoder_registry()) names.push_back(d.first);
+        return names;
+    });
+
+    m.def("set_eval_cache_size", [](size_t n) { eval_cache.set_capacity(n); }, py::arg("capacity"));
+    m.def("clear_eval_cache", []() { eval_cache.clear(); });
+    m.def("eval_cache_info", []() { return eval_cache.info(); });
+    m.def("clear_runtime_history", []() { runtime_history.clear(); });
 }
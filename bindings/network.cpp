@@ -1,6 +1,10 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include "network.hpp"
+#include "archive.hpp"
+#include "network_diff.hpp"
+#include "optimizer.hpp"
 #include "constants.hpp"
 
 #include "nlohmann/json.hpp"
@@ -9,6 +13,30 @@
 namespace py = pybind11;
 namespace csp = caspian;
 
+/* hands a vector over to numpy without copying */
+template <typename T>
+static py::array_t<T> to_numpy(std::vector<T> &&v)
+{
+    auto *owned = new std::vector<T>(std::move(v));
+
+    py::capsule free_when_done(owned, [](void *f) {
+        delete reinterpret_cast<std::vector<T>*>(f);
+    });
+
+    return py::array_t<T>({owned->size()}, {sizeof(T)}, owned->data(), free_when_done);
+}
+
+template <typename T>
+using flat_array = py::array_t<T, py::array::c_style | py::array::forcecast>;
+
+template <typename T>
+static size_t flat_size(const flat_array<T> &a, const char *name)
+{
+    if(a.ndim() != 1)
+        throw std::invalid_argument(std::string("[from_arrays] ") + name + " must be one dimensional");
+    return a.size();
+}
+
 void bind_network(py::module &m) {
     /* Network Bindings
      *   Neurons, Synapses, Networks, and associatied types/utilities
@@ -59,6 +87,19 @@ void bind_network(py::module &m) {
         .def("from_str", &csp::Network::from_str)
         .def("to_str", &csp::Network::to_str)
         .def("to_gml", &csp::Network::to_gml)
+        .def("to_bytes", [](const csp::Network &net) {
+            std::vector<uint8_t> buf;
+            {
+                py::gil_scoped_release release;
+                net.to_bytes(buf);
+            }
+            return py::bytes(reinterpret_cast<const char*>(buf.data()), buf.size());
+        })
+        .def("from_bytes", [](csp::Network &net, const py::bytes &b) {
+            std::string s = b;
+            py::gil_scoped_release release;
+            return net.from_bytes(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+        }, py::arg("data"))
 
         .def("dump", &csp::Network::to_json)
         .def("load", &csp::Network::from_json)
@@ -102,19 +143,108 @@ void bind_network(py::module &m) {
             net.remove_neuron(key); 
         })
         
-        /* Pickle support -- under development */
+        /* Pickle support -- the state is the compact binary encoding (version 2). Version 1
+         * states, which held the JSON string, can still be loaded. */
         .def(py::pickle(
             [](const csp::Network &net){
-                std::string str = net.to_str();
-                return py::make_tuple(str, 1);
+                std::vector<uint8_t> buf;
+                {
+                    py::gil_scoped_release release;
+                    net.to_bytes(buf);
+                }
+                return py::make_tuple(py::bytes(reinterpret_cast<const char*>(buf.data()), buf.size()), 2);
             },
             [](py::tuple t){
+                if(t.size() != 2)
+                    throw std::runtime_error("[Network] Invalid pickle state");
+
                 csp::Network net;
-                net.from_str(t[0].cast<std::string>());
+                int version = t[1].cast<int>();
+
+                if(version == 1)
+                {
+                    net.from_str(t[0].cast<std::string>());
+                }
+                else if(version == 2)
+                {
+                    std::string s = t[0].cast<py::bytes>();
+
+                    py::gil_scoped_release release;
+                    if(net.from_bytes(reinterpret_cast<const uint8_t*>(s.data()), s.size()) != s.size())
+                        throw std::runtime_error("[Network] Trailing data in pickle state");
+                }
+                else
+                {
+                    throw std::runtime_error("[Network] Unsupported pickle state version " + std::to_string(version));
+                }
+
                 return net;
             }
         ))
 
+        /* Bulk construction -- numpy arrays in, built natively without the GIL. The configuration
+         * is kept unless given. to_arrays() returns a dict keyed like these arguments (including
+         * the configuration), so net.from_arrays(**other.to_arrays()) copies. */
+        .def("from_arrays", [](csp::Network &net,
+                               const flat_array<uint32_t> &neuron_ids, const flat_array<int16_t> &thresholds,
+                               const flat_array<int8_t> &leaks, const flat_array<uint8_t> &delays,
+                               const flat_array<uint32_t> &src, const flat_array<uint32_t> &dst,
+                               const flat_array<int16_t> &weights, const flat_array<uint8_t> &syn_delays,
+                               const flat_array<int32_t> &inputs, const flat_array<int32_t> &outputs,
+                               py::object max_size, py::object max_thresh, py::object soft_reset) {
+            size_t n = flat_size(neuron_ids, "neuron_ids");
+            if(flat_size(thresholds, "thresholds") != n || flat_size(leaks, "leaks") != n ||
+               flat_size(delays, "delays") != n)
+                throw std::invalid_argument("[from_arrays] Neuron arrays must have matching length");
+
+            size_t s = flat_size(src, "src");
+            if(flat_size(dst, "dst") != s || flat_size(weights, "weights") != s ||
+               flat_size(syn_delays, "syn_delays") != s)
+                throw std::invalid_argument("[from_arrays] Synapse arrays must have matching length");
+
+            size_t n_in = flat_size(inputs, "inputs");
+            size_t n_out = flat_size(outputs, "outputs");
+
+            {
+                py::gil_scoped_release release;
+                net.from_arrays(n, neuron_ids.data(), thresholds.data(), leaks.data(), delays.data(),
+                                s, src.data(), dst.data(), weights.data(), syn_delays.data(),
+                                n_in, inputs.data(), n_out, outputs.data());
+            }
+
+            if(!max_size.is_none()) net.set_max_size(max_size.cast<size_t>());
+            if(!max_thresh.is_none()) net.max_thresh = max_thresh.cast<uint16_t>();
+            if(!soft_reset.is_none()) net.soft_reset = soft_reset.cast<bool>();
+        },
+        py::arg("neuron_ids"), py::arg("thresholds"), py::arg("leaks"), py::arg("delays"),
+        py::arg("src"), py::arg("dst"), py::arg("weights"), py::arg("syn_delays"),
+        py::arg("inputs"), py::arg("outputs"),
+        py::arg("max_size") = py::none(), py::arg("max_thresh") = py::none(), py::arg("soft_reset") = py::none())
+
+        .def("to_arrays", [](const csp::Network &net) {
+            csp::NetworkArrays a;
+            {
+                py::gil_scoped_release release;
+                a = net.to_arrays();
+            }
+
+            py::dict d;
+            d["neuron_ids"] = to_numpy(std::move(a.neuron_ids));
+            d["thresholds"] = to_numpy(std::move(a.thresholds));
+            d["leaks"] = to_numpy(std::move(a.leaks));
+            d["delays"] = to_numpy(std::move(a.delays));
+            d["src"] = to_numpy(std::move(a.src));
+            d["dst"] = to_numpy(std::move(a.dst));
+            d["weights"] = to_numpy(std::move(a.weights));
+            d["syn_delays"] = to_numpy(std::move(a.syn_delays));
+            d["inputs"] = to_numpy(std::move(a.inputs));
+            d["outputs"] = to_numpy(std::move(a.outputs));
+            d["max_size"] = a.max_size;
+            d["max_thresh"] = a.max_thresh;
+            d["soft_reset"] = a.soft_reset;
+            return d;
+        })
+
         /* Neurons */
         .def("add_neuron", 
             (void (csp::Network::*)(uint32_t,int16_t,int8_t,uint8_t)) &csp::Network::add_neuron,
@@ -164,9 +294,97 @@ void bind_network(py::module &m) {
 
         /* misc */
         .def("get_metric", &csp::Network::get_metric, py::arg("metric"))
+        .def("rebuild_stats", &csp::Network::rebuild_stats)
+        .def("get_fan_in_histogram", [](const csp::Network &net) { return net.get_stats().fan_in_histogram(); })
+        .def("get_fan_out_histogram", [](const csp::Network &net) { return net.get_stats().fan_out_histogram(); })
         .def("reset", &csp::Network::reset)
         .def("clear_activity", &csp::Network::clear_activity)
         .def("prune", &csp::Network::prune, py::arg("io_prune") = false)
         .def("get_time", &csp::Network::get_time)
+        .def("structural_hash", &csp::Network::structural_hash)
+        .def("diff", &csp::Network::diff, py::arg("base"))
+        .def("apply_patch", &csp::Network::apply_patch, py::arg("diff"))
         .def_readwrite("soft_reset", &csp::Network::soft_reset);
+
+    /* Network diffs */
+    py::class_<csp::NetworkDiff>(m, "NetworkDiff")
+        .def(py::init<>())
+        .def("empty", &csp::NetworkDiff::empty)
+        .def_readonly("base_hash", &csp::NetworkDiff::base_hash)
+        .def_readonly("target_hash", &csp::NetworkDiff::target_hash)
+        .def_readonly("removed_neurons", &csp::NetworkDiff::removed_neurons)
+        .def_readonly("removed_synapses", &csp::NetworkDiff::removed_synapses)
+        .def("to_bytes", [](const csp::NetworkDiff &d) {
+            std::vector<uint8_t> buf = d.to_bytes();
+            return py::bytes(reinterpret_cast<const char*>(buf.data()), buf.size());
+        })
+        .def_static("from_bytes", [](const py::bytes &b) {
+            std::string s = b;
+            csp::NetworkDiff d;
+            d.from_bytes(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+            return d;
+        }, py::arg("data"));
+
+    /* Population archives */
+    py::class_<csp::PopulationArchive>(m, "PopulationArchive")
+        .def(py::init<const std::string&>(), py::arg("path"))
+
+        .def("__len__", &csp::PopulationArchive::size)
+
+        .def("__getitem__", [](const csp::PopulationArchive &a, size_t idx) {
+            if(idx >= a.size())
+                throw py::index_error();
+
+            return a.load(idx);
+        }, py::return_value_policy::take_ownership)
+
+        .def("load", [](const csp::PopulationArchive &a, size_t idx, csp::Network &net) {
+            a.load(idx, net);
+        }, py::arg("idx"), py::arg("network"));
+
+    m.def("make_random_networks", [](size_t count, size_t size, int n_inputs, int n_outputs, uint64_t seed,
+                                     int n_input_synapses, int n_output_synapses,
+                                     int n_hidden_synapses, int n_hidden_synapses_max,
+                                     double inhibitory_percentage,
+                                     std::pair<int,int> threshold_range, std::pair<int,int> leak_range,
+                                     std::pair<int,int> weight_range, std::pair<int,int> delay_range,
+                                     int num_threads) {
+            csp::RandomNetworkParams p;
+            p.n_inputs = n_inputs;
+            p.n_outputs = n_outputs;
+            if(n_input_synapses != -1) p.n_input_synapses = n_input_synapses;
+            if(n_output_synapses != -1) p.n_output_synapses = n_output_synapses;
+            if(n_hidden_synapses != -1) p.n_hidden_synapses = n_hidden_synapses;
+            p.n_hidden_synapses_max = n_hidden_synapses_max;
+            p.inhibitory_percentage = inhibitory_percentage;
+            p.threshold_range = threshold_range;
+            p.leak_range = leak_range;
+            p.weight_range = weight_range;
+            p.delay_range = delay_range;
+
+            std::vector<csp::Network*> nets;
+            {
+                py::gil_scoped_release release;
+                nets = csp::make_random_networks(count, size, seed, p, num_threads);
+            }
+            return nets;
+        },
+        py::return_value_policy::take_ownership,
+        py::arg("count"), py::arg("size"), py::arg("n_inputs"), py::arg("n_outputs"), py::arg("seed"),
+        py::arg("n_input_synapses") = -1,
+        py::arg("n_output_synapses") = -1,
+        py::arg("n_hidden_synapses") = -1,
+        py::arg("n_hidden_synapses_max") = -1,
+        py::arg("inhibitory_percentage") = 0.2,
+        py::arg("threshold_range") = std::make_pair(csp::constants::MIN_THRESHOLD, csp::constants::MAX_THRESHOLD),
+        py::arg("leak_range") = std::make_pair(csp::constants::MIN_LEAK, csp::constants::MAX_LEAK),
+        py::arg("weight_range") = std::make_pair(0, csp::constants::MAX_WEIGHT),
+        py::arg("delay_range") = std::make_pair(csp::constants::MIN_DELAY, csp::constants::MAX_DELAY),
+        py::arg("num_threads") = 0);
+
+    m.def("optimize_network", [](csp::Network &net) {
+        return csp::optimize_network(net).to_json();
+    }, py::arg("network"));
+
+    m.def("write_population_archive", &csp::write_population_archive, py::arg("path"), py::arg("networks"));
 }
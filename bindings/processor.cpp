@@ -1,4 +1,5 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
 #include "framework.hpp"
@@ -15,9 +16,49 @@ void bind_processor(pybind11::module &m) {
     py::module::import("neuro");
     py::object n_processor = (py::object) py::module::import("neuro").attr("Processor");
 
+    // see the threading notes in the README
+    using release_gil = py::call_guard<py::gil_scoped_release>;
+
     py::class_<csp::Processor>(m, "Processor", n_processor)
-        .def(py::init<nlohmann::json&>())
+        .def(py::init<nlohmann::json&>(), release_gil())
+
+        /* The long running calls are bound again here so they release the GIL */
+        .def("load_network", &csp::Processor::load_network, py::arg("n"), py::arg("network_id") = 0, release_gil())
+        .def("load_networks", &csp::Processor::load_networks, py::arg("n"), release_gil())
+        .def("run", (void (csp::Processor::*)(double, int)) &csp::Processor::run,
+                py::arg("duration"), py::arg("network_id") = 0, release_gil())
+        .def("run", (void (csp::Processor::*)(double, const std::vector<int>&)) &csp::Processor::run,
+                py::arg("duration"), py::arg("network_ids"), release_gil())
+        .def("clear_activity", &csp::Processor::clear_activity, py::arg("network_id") = 0, release_gil())
+        .def("output_counts", &csp::Processor::output_counts, py::arg("network_id") = 0, release_gil())
+        .def("output_last_fires", &csp::Processor::output_last_fires, py::arg("network_id") = 0, release_gil())
+        .def("output_vectors", &csp::Processor::output_vectors, py::arg("network_id") = 0, release_gil())
+        .def("neuron_counts", &csp::Processor::neuron_counts, py::arg("network_id") = 0, release_gil())
+        .def("neuron_last_fires", &csp::Processor::neuron_last_fires, py::arg("network_id") = 0, release_gil())
+        .def("neuron_vectors", &csp::Processor::neuron_vectors, py::arg("network_id") = 0, release_gil())
+        .def("neuron_charges", &csp::Processor::neuron_charges, py::arg("network_id") = 0, release_gil())
+
         .def("get_backend", &csp::Processor::get_backend, py::return_value_policy::reference_internal)
         .def("get_internal_network", &csp::Processor::get_internal_network, py::return_value_policy::reference_internal)
-        .def("get_configuration", &csp::Processor::get_configuration);
+        .def("get_configuration", &csp::Processor::get_configuration)
+        .def("get_optimizer_report", &csp::Processor::get_optimizer_report, py::arg("network_id") = 0)
+
+        /* (counts, last_fires, charges) as numpy arrays filled in a single pass */
+        .def("neuron_activity", [](csp::Processor &p, int network_id) {
+            py::ssize_t n = p.num_readout_neurons(network_id);
+            py::array_t<int> counts(n);
+            py::array_t<double> last_fires(n);
+            py::array_t<double> charges(n);
+
+            int *c = counts.mutable_data();
+            double *lf = last_fires.mutable_data();
+            double *ch = charges.mutable_data();
+
+            {
+                py::gil_scoped_release release;
+                p.read_neuron_activity(c, lf, ch, network_id);
+            }
+
+            return py::make_tuple(counts, last_fires, charges);
+        }, py::arg("network_id") = 0);
 }
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <utility>
+
+#include "network.hpp"
+
+namespace caspian
+{
+    /* Population archives store many networks in a single file using the binary network
+     * record format (Network::to_bytes). The layout is:
+     *
+     *   [ header (32 bytes) ][ record 0 ][ record 1 ] ... [ index: (offset, size) per record ]
+     *
+     * The header holds a magic string, the format version, the record count, and the
+     * offset of the index. Archives are opened with mmap so that networks can be decoded
+     * lazily and so several processes evaluating the same population share one page cache. */
+    namespace archive
+    {
+        const char     MAGIC[8] = {'C','A','S','P','A','R','C','\0'};
+        const uint32_t VERSION = 1;
+        const size_t   HEADER_SIZE = 32;
+        const size_t   INDEX_ENTRY_SIZE = 16;
+    }
+
+    /* Streams networks into an archive file -- records are written as they are added */
+    class PopulationArchiveWriter
+    {
+    public:
+        PopulationArchiveWriter(const std::string &path);
+        ~PopulationArchiveWriter();
+
+        PopulationArchiveWriter(const PopulationArchiveWriter&) = delete;
+        PopulationArchiveWriter& operator=(const PopulationArchiveWriter&) = delete;
+
+        /* Append a network and return its index within the archive */
+        size_t add(const Network &net);
+
+        /* Write the index and header -- called automatically on destruction */
+        void close();
+
+    private:
+        std::ofstream m_out;
+        std::vector<std::pair<uint64_t, uint64_t>> m_index;
+        std::vector<uint8_t> m_buf;
+        uint64_t m_offset = 0;
+        bool m_closed = false;
+    };
+
+    /* Read-only, memory-mapped view of an archive */
+    class PopulationArchive
+    {
+    public:
+        PopulationArchive(const std::string &path);
+        ~PopulationArchive();
+
+        PopulationArchive(const PopulationArchive&) = delete;
+        PopulationArchive& operator=(const PopulationArchive&) = delete;
+        PopulationArchive(PopulationArchive &&a) noexcept;
+        PopulationArchive& operator=(PopulationArchive &&a) noexcept;
+
+        /* Number of networks in the archive */
+        size_t size() const;
+
+        /* Decode a network directly from the mapped bytes */
+        void load(size_t idx, Network &net) const;
+        Network* load(size_t idx) const;
+
+        /* Raw record access (pointer into the mapping, record size) */
+        std::pair<const uint8_t*, size_t> record(size_t idx) const;
+
+    private:
+        void unmap();
+
+        const uint8_t *m_data = nullptr;
+        size_t m_len = 0;
+        size_t m_count = 0;
+        const uint8_t *m_index = nullptr;
+    };
+
+    /* Convenience wrapper to write a whole population at once */
+    void write_population_archive(const std::string &path, const std::vector<Network*> &networks);
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -14,11 +14,12 @@ namespace caspian
     struct InputFireEvent
     {
         uint32_t id;   // input id for "to" neuron
+        int32_t net;   // index of the target network in a batch (-1 => every network)
         uint64_t time;
         int16_t weight;
 
         InputFireEvent() = delete;
-        InputFireEvent(uint32_t elm, int16_t w, uint64_t t) : id(elm), time(t), weight(w) {};
+        InputFireEvent(uint32_t elm, int16_t w, uint64_t t, int32_t n = -1) : id(elm), net(n), time(t), weight(w) {};
         InputFireEvent(const InputFireEvent &e) = default;
         InputFireEvent(InputFireEvent &&e) = default;
         ~InputFireEvent() = default;
@@ -42,6 +43,26 @@ namespace caspian
         }
     };
 
+    /* Every spike recorded during a simulate() call (see collect_all_spikes) in flat form.
+     * The spikes of cycle t are [offsets[t], end(t)) of ids. With a batch of networks
+     * loaded, nets holds the network index of each spike (empty otherwise). */
+    struct SpikeBuffer
+    {
+        std::vector<uint32_t> ids;
+        std::vector<uint32_t> nets;
+        std::vector<size_t> offsets;
+
+        size_t cycles() const { return offsets.size(); }
+        size_t end(size_t t) const { return (t+1 < offsets.size()) ? offsets[t+1] : ids.size(); }
+
+        void clear()
+        {
+            ids.clear();
+            nets.clear();
+            offsets.clear();
+        }
+    };
+
     /* Simulation interface for CASPIAN devices */
     class Backend
     {
@@ -53,10 +74,19 @@ namespace caspian
         virtual Network* pull_network(uint32_t idx) const = 0;
 
         virtual void apply_input(int input_id, int16_t w, uint64_t t) = 0;
+        /* Queue an input for a single network of a batch loaded with configure_multi */
+        virtual void apply_input(int input_id, int16_t w, uint64_t t, int network_id) = 0;
+        /* Queue count inputs at once (network_id -1 => every network of a batch) */
+        virtual void apply_inputs(const int *input_ids, const int16_t *w, const uint64_t *t,
+                                  size_t count, int network_id = -1) = 0;
         virtual bool simulate(uint64_t steps) = 0;
         virtual bool update() = 0;
 
         virtual double get_metric(const std::string &metric) = 0;
+        /* "fire_count" or "accumulate_count" of a single network (of a batch) during the
+         * last simulate() call -- unlike get_metric, this does not reset on read. Backends
+         * without per-run counters throw std::logic_error. */
+        virtual double get_network_metric(const std::string &metric, int network_id) = 0;
         virtual uint64_t get_time() const = 0;
 
         virtual void reset() = 0;
@@ -74,6 +104,7 @@ namespace caspian
         virtual void collect_all_spikes(bool collect = true) = 0; 
         virtual std::vector<std::vector<uint32_t>> get_all_spikes() = 0;
         virtual UIntMap get_all_spike_cnts() = 0;
+        virtual const SpikeBuffer& get_spike_buffer() const = 0;
 
         virtual ~Backend() = default;
     };
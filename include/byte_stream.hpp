@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+namespace caspian
+{
+    /* Minimal helpers for the compact binary formats (network records, archives, etc.).
+     * Multi-byte values are always little-endian on disk regardless of the host. Integers
+     * which are usually small (ids, counts, weights) use LEB128 varints with zigzag for
+     * signed values, so most network elements only take a couple of bytes. */
+    class ByteWriter
+    {
+    public:
+        explicit ByteWriter(std::vector<uint8_t> &buf) : m_buf(buf) {}
+
+        inline void u8(uint8_t v)
+        {
+            m_buf.push_back(v);
+        }
+
+        inline void u32(uint32_t v)
+        {
+            for(int i = 0; i < 4; i++)
+                m_buf.push_back(static_cast<uint8_t>(v >> (8*i)));
+        }
+
+        inline void u64(uint64_t v)
+        {
+            for(int i = 0; i < 8; i++)
+                m_buf.push_back(static_cast<uint8_t>(v >> (8*i)));
+        }
+
+        inline void uvar(uint64_t v)
+        {
+            while(v >= 0x80)
+            {
+                m_buf.push_back(static_cast<uint8_t>(v | 0x80));
+                v >>= 7;
+            }
+            m_buf.push_back(static_cast<uint8_t>(v));
+        }
+
+        inline void svar(int64_t v)
+        {
+            uvar((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+        }
+
+        inline void bytes(const void *p, size_t n)
+        {
+            if(n == 0) return;
+            size_t pos = m_buf.size();
+            m_buf.resize(pos + n);
+            std::memcpy(&m_buf[pos], p, n);
+        }
+
+        inline size_t size() const { return m_buf.size(); }
+
+    private:
+        std::vector<uint8_t> &m_buf;
+    };
+
+    class ByteReader
+    {
+    public:
+        ByteReader(const uint8_t *data, size_t len) : m_pos(data), m_end(data + len), m_start(data) {}
+
+        inline uint8_t u8()
+        {
+            need(1);
+            return *m_pos++;
+        }
+
+        inline uint32_t u32()
+        {
+            need(4);
+            uint32_t v = 0;
+            for(int i = 0; i < 4; i++)
+                v |= static_cast<uint32_t>(m_pos[i]) << (8*i);
+            m_pos += 4;
+            return v;
+        }
+
+        inline uint64_t u64()
+        {
+            need(8);
+            uint64_t v = 0;
+            for(int i = 0; i < 8; i++)
+                v |= static_cast<uint64_t>(m_pos[i]) << (8*i);
+            m_pos += 8;
+            return v;
+        }
+
+        inline uint64_t uvar()
+        {
+            uint64_t v = 0;
+            for(int shift = 0; shift < 64; shift += 7)
+            {
+                uint8_t b = u8();
+                v |= static_cast<uint64_t>(b & 0x7f) << shift;
+                if(!(b & 0x80)) return v;
+            }
+            throw std::runtime_error("[ByteReader] Malformed varint");
+        }
+
+        inline int64_t svar()
+        {
+            uint64_t v = uvar();
+            return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+        }
+
+        /* varints which must fit in T */
+        template <typename T>
+        inline T uvar_as()
+        {
+            uint64_t v = uvar();
+            if(v > static_cast<uint64_t>(std::numeric_limits<T>::max()))
+                throw std::runtime_error("[ByteReader] Value out of range");
+            return static_cast<T>(v);
+        }
+
+        template <typename T>
+        inline T svar_as()
+        {
+            int64_t v = svar();
+            if(v < std::numeric_limits<T>::min() || v > std::numeric_limits<T>::max())
+                throw std::runtime_error("[ByteReader] Value out of range");
+            return static_cast<T>(v);
+        }
+
+        inline const uint8_t* bytes(size_t n)
+        {
+            need(n);
+            const uint8_t *p = m_pos;
+            m_pos += n;
+            return p;
+        }
+
+        inline size_t consumed() const { return m_pos - m_start; }
+        inline size_t remaining() const { return m_end - m_pos; }
+
+    private:
+        inline void need(size_t n) const
+        {
+            if(size_t(m_end - m_pos) < n)
+                throw std::runtime_error("[ByteReader] Unexpected end of data");
+        }
+
+        const uint8_t *m_pos;
+        const uint8_t *m_end;
+        const uint8_t *m_start;
+    };
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
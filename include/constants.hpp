@@ -98,6 +98,9 @@ namespace caspian
         /* version of the CASPIAN serialization format */
         const double  FORMAT_VER = 0.4;
 
+        /* version of the CASPIAN binary network record format */
+        const uint8_t BINARY_FORMAT_VER = 1;
+
         /*** Note: These parameters are magically determined. That said, I cannot promise that these are good. (ported from DANNA2 -> CASPIAN ***/
 
         /* Relative weight of mutating different properties */
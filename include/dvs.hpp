@@ -0,0 +1,140 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "backend.hpp"
+#include "constants.hpp"
+
+namespace caspian
+{
+    /* How event camera (DVS) events map onto device inputs. Pixel (x, y) becomes input
+     * (y/downsample) * out_width + (x/downsample), and with use_polarity the positive events
+     * are offset by one (downsampled) frame. An event at time t lands on cycle
+     * floor((t - time_offset) / time_bin). */
+    struct DvsConfig
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        bool use_polarity = true;
+        double time_bin = 1;
+        double time_offset = 0;
+        uint32_t downsample = 1;
+        uint64_t refractory = 0;    // cycles an input ignores events after one is accepted
+        int16_t charge = constants::MAX_DEVICE_INPUT;
+    };
+
+    /* Converts batches of DVS events into flat (input, charge, cycle) arrays for
+     * Backend::apply_inputs. The refractory state is kept between calls, so a stream can be
+     * converted in consecutive chunks; events are expected in time order. */
+    class DvsConverter
+    {
+    public:
+        explicit DvsConverter(const DvsConfig &config);
+
+        const DvsConfig& config() const { return m_cfg; }
+
+        /* inputs the network needs */
+        uint32_t num_inputs() const;
+
+        /* Converts n events into ids/charges/times (replacing their contents). Events before
+         * time_offset (or before base_cycle) or inside the refractory period of their input are
+         * dropped. Times are given relative to base_cycle. p may be null without polarity.
+         * Returns the number of events kept. */
+        size_t convert(const int32_t *x, const int32_t *y, const int32_t *p, const double *t, size_t n,
+                       std::vector<int> &ids, std::vector<int16_t> &charges, std::vector<uint64_t> &times,
+                       uint64_t base_cycle = 0);
+
+        /* converts and injects through the bulk input path */
+        size_t apply(Backend *dev, const int32_t *x, const int32_t *y, const int32_t *p, const double *t, size_t n,
+                     int network_id = -1, uint64_t base_cycle = 0);
+
+        /* cycle of an event time (times before time_offset map to 0) */
+        uint64_t cycle_of(double t) const;
+
+        /* forgets the refractory state */
+        void reset();
+
+    private:
+        DvsConfig m_cfg;
+        uint32_t m_out_width;
+        uint32_t m_out_height;
+        std::vector<uint64_t> m_ready;   // first cycle each input accepts an event again
+
+        std::vector<int> m_ids;
+        std::vector<int16_t> m_charges;
+        std::vector<uint64_t> m_times;
+    };
+
+    /* One field of a fixed size event record: an unsigned integer of the given number of
+     * bytes at offset, then shifted right and masked to bits. Absent fields have 0 bytes
+     * and read as 0. */
+    struct DvsField
+    {
+        uint32_t offset = 0;
+        uint32_t bytes = 0;
+        uint32_t shift = 0;
+        uint32_t bits = 64;
+        bool big_endian = false;
+
+        uint64_t read(const uint8_t *record) const;
+    };
+
+    /* Layout of a raw binary event file: a header which is skipped, then packed records.
+     * Raw times are multiplied by time_scale. */
+    struct DvsLayout
+    {
+        size_t header = 0;
+        size_t record_size = 0;
+        DvsField x, y, p, t;
+        double time_scale = 1;
+
+        /* N-MNIST / N-Caltech101: 40 bit big endian records of x (8), y (8), p (1), and
+         * t (23, microseconds) */
+        static DvsLayout nmnist();
+    };
+
+    /* Read-only, memory-mapped event file. Events are decoded on demand, so recordings far
+     * larger than memory can be replayed window by window. Events must be in time order. */
+    class DvsFile
+    {
+    public:
+        DvsFile(const std::string &path, const DvsLayout &layout);
+        ~DvsFile();
+
+        DvsFile(const DvsFile&) = delete;
+        DvsFile& operator=(const DvsFile&) = delete;
+
+        const DvsLayout& layout() const { return m_layout; }
+
+        /* Number of events in the file */
+        size_t size() const { return m_count; }
+
+        /* Time of event i (scaled) */
+        double time(size_t i) const;
+
+        /* Index of the first event at or after time t */
+        size_t find(double t) const;
+
+        /* Decode events [begin, end) into caller-provided arrays of end - begin entries */
+        void read(size_t begin, size_t end, int32_t *x, int32_t *y, int32_t *p, double *t) const;
+
+        /* Converts the events with times in [t0, t1) and queues them on the backend, with
+         * cycles counted from the cycle of t0. Returns the number of events kept. */
+        size_t apply_window(DvsConverter &conv, Backend *dev, double t0, double t1, int network_id = -1);
+
+    private:
+        const uint8_t* record(size_t i) const { return m_data + m_layout.header + i * m_layout.record_size; }
+
+        DvsLayout m_layout;
+        const uint8_t *m_data = nullptr;
+        size_t m_len = 0;
+        size_t m_count = 0;
+
+        std::vector<int32_t> m_x, m_y, m_p;
+        std::vector<double> m_t;
+    };
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
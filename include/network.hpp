@@ -1,9 +1,11 @@
 #pragma once
+#include <array>
 #include <cstdint>
 #include <vector>
 #include <set>
 #include <map>
 #include <stdexcept>
+#include <string>
 
 #include "nlohmann/json.hpp"
 #include "robinhood/robin_map.h"
@@ -19,6 +21,7 @@ namespace caspian
     struct Synapse;
     struct Neuron;
     class Network;
+    struct NetworkDiff;
 
     struct int_hash
     {
@@ -35,6 +38,15 @@ namespace caspian
         }
     };
 
+    /* splitmix64 finalizer -- spreads each element's fields over all 64 bits */
+    inline uint64_t hash_mix(uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
     /* Robin Hood Hash Table to hold the neurons for a network */
     typedef tsl::robin_map<uint32_t, Neuron*> NeuronTable;
 
@@ -106,8 +118,8 @@ namespace caspian
         /* IO id */
         int        input_id = -1;
         int        output_id = -1;
-        /* meta */
-        int        tag = -1;
+        /* meta -- index of the network within a simulated batch */
+        int        tag = 0;
         /* current stored charge from accumulated fires */
         int32_t    charge = 0;
         /* threshold before the neuron will fire */
@@ -138,6 +150,98 @@ namespace caspian
         friend class Network;
     };
 
+    /* Structural statistics of a network, kept up to date by every Network method which adds,
+     * removes, or changes neurons and synapses, so queries are O(1). Weights or delays
+     * changed directly through a Synapse&/Neuron& reference are not seen -- call
+     * Network::rebuild_stats() after doing that. */
+    class NetworkStats
+    {
+    public:
+        void clear();
+
+        /* neurons (a new neuron has no synapses) */
+        void add_neuron(uint8_t delay);
+        void remove_neuron(size_t fan_in, size_t fan_out, uint8_t delay);
+        void change_neuron(uint8_t old_delay, uint8_t new_delay);
+
+        /* synapse values -- degrees are tracked separately */
+        void add_synapse(int16_t weight, uint8_t delay);
+        void remove_synapse(int16_t weight, uint8_t delay);
+
+        /* a neuron's number of incoming/outgoing synapses changed */
+        void move_fan_in(size_t from, size_t to);
+        void move_fan_out(size_t from, size_t to);
+
+        size_t positive_synapses() const { return m_positive; }
+        size_t negative_synapses() const { return m_negative; }
+        size_t max_fan_in() const { return m_fan_in_hist.empty() ? 0 : m_fan_in_hist.size() - 1; }
+        size_t max_fan_out() const { return m_fan_out_hist.empty() ? 0 : m_fan_out_hist.size() - 1; }
+        size_t max_synapse_delay() const;
+        size_t max_axon_delay() const;
+        double mean_synapse_delay() const;
+        double mean_axon_delay() const;
+
+        /* histogram[k] = number of neurons (synapses) with degree (delay) k */
+        const std::vector<size_t>& fan_in_histogram() const { return m_fan_in_hist; }
+        const std::vector<size_t>& fan_out_histogram() const { return m_fan_out_hist; }
+        const std::array<size_t, 256>& synapse_delay_histogram() const { return m_syn_delay_hist; }
+        const std::array<size_t, 256>& axon_delay_histogram() const { return m_axon_delay_hist; }
+
+    private:
+        static void hist_move(std::vector<size_t> &hist, size_t from, size_t to);
+        static void hist_trim(std::vector<size_t> &hist);
+
+        size_t m_positive = 0;
+        size_t m_negative = 0;
+        size_t m_synapses = 0;
+        size_t m_neurons = 0;
+        uint64_t m_syn_delay_sum = 0;
+        uint64_t m_axon_delay_sum = 0;
+
+        std::vector<size_t> m_fan_in_hist;
+        std::vector<size_t> m_fan_out_hist;
+        std::array<size_t, 256> m_syn_delay_hist = {};
+        std::array<size_t, 256> m_axon_delay_hist = {};
+    };
+
+    /* Parameters for bulk random generation -- these mirror Network::make_random() */
+    struct RandomNetworkParams
+    {
+        int n_inputs = 0;
+        int n_outputs = 0;
+        int n_input_synapses = 12;
+        int n_output_synapses = 12;
+        int n_hidden_synapses = 6;
+        int n_hidden_synapses_max = -1; // -1 => 1.2 * n_hidden_synapses
+        double inhibitory_percentage = 0.2;
+        std::pair<int,int> threshold_range = std::make_pair(0,255);
+        std::pair<int,int> leak_range = std::make_pair(0,3);
+        std::pair<int,int> weight_range = std::make_pair(0,255);
+        std::pair<int,int> delay_range = std::make_pair(0,15);
+    };
+
+    /* Flat, column-wise copy of a network -- see Network::to_arrays() / from_arrays() */
+    struct NetworkArrays
+    {
+        std::vector<uint32_t> neuron_ids;
+        std::vector<int16_t>  thresholds;
+        std::vector<int8_t>   leaks;
+        std::vector<uint8_t>  delays;
+
+        std::vector<uint32_t> src;
+        std::vector<uint32_t> dst;
+        std::vector<int16_t>  weights;
+        std::vector<uint8_t>  syn_delays;
+
+        std::vector<int32_t>  inputs;     // neuron id per input, -1 if unset
+        std::vector<int32_t>  outputs;
+
+        /* configuration */
+        size_t                max_size = 0;
+        uint16_t              max_thresh = constants::MAX_THRESHOLD;
+        bool                  soft_reset = false;
+    };
+
     class Network
     {
     public:
@@ -158,6 +262,16 @@ namespace caspian
         /* Equality */
         bool operator==(const Network &rhs) const;
 
+        /* Structural fingerprint -- covers neurons, synapses, configuration, and the i/o
+         * mapping but not activity. Equal networks always hash equally regardless of the
+         * order in which elements were added. */
+        uint64_t                structural_hash() const;
+
+        /* Changes turning base into this network, and applying such changes to (a copy of)
+         * the base -- see network_diff.hpp */
+        NetworkDiff             diff(const Network &base) const;
+        void                    apply_patch(const NetworkDiff &d);
+
         /* Serialization methods */
         void                    from_str(const std::string &s);
         std::string             to_str() const;
@@ -173,6 +287,28 @@ namespace caspian
         void                    from_stream(std::istream &st);
         void                    to_stream(std::ostream &st) const;
 
+        /* Compact binary serialization -- much faster than JSON and used for archives */
+        std::vector<uint8_t>    to_bytes() const;
+        void                    to_bytes(std::vector<uint8_t> &buf) const;
+        size_t                  from_bytes(const uint8_t *data, size_t len);
+
+        /* Bulk construction from flat arrays, replacing the current contents. Synapses are
+         * (src[i] -> dst[i]) and are sorted by (dst, src) before insertion unless they already
+         * are; a repeated synapse keeps its last entry. Input/output entries are neuron ids
+         * with -1 for unset. The pointer form keeps the current configuration, the
+         * NetworkArrays form takes it from the arrays. */
+        void                    from_arrays(size_t n_neurons, const uint32_t *ids, const int16_t *thresholds,
+                                            const int8_t *leaks, const uint8_t *delays,
+                                            size_t n_synapses, const uint32_t *src, const uint32_t *dst,
+                                            const int16_t *weights, const uint8_t *syn_delays,
+                                            size_t n_inputs, const int32_t *inputs,
+                                            size_t n_outputs, const int32_t *outputs);
+        void                    from_arrays(const NetworkArrays &a);
+
+        /* Neurons in id order and synapses in (dst, src) order, which from_arrays() takes as
+         * is, along with the configuration */
+        NetworkArrays           to_arrays() const;
+
         /* Misc functions */
         void                    reset();
         void                    clear_activity();
@@ -194,9 +330,14 @@ namespace caspian
                                             std::pair<int,int> weight_range = std::make_pair(0,255),
                                             std::pair<int,int> delay_range = std::make_pair(0,15));
 
+        /* Same structure as make_random() but with an unbiased splitmix64 stream and the
+         * synapses built in one sorted pass. Used by make_random_networks(). */
+        void                    generate_random(const RandomNetworkParams &params, uint64_t seed);
+
         /* Configuration functions */
         uint64_t                get_time() const;
         uint32_t                get_max_size() const;
+        void                    set_max_size(size_t size);
         void                    set_time(uint64_t t);
 
         /* Neuron functions */
@@ -204,6 +345,7 @@ namespace caspian
         void                    add_neuron(uint32_t nid, int16_t thresh, int8_t leak=-1, uint8_t delay = 0);
         void                    add_neuron(nlohmann::json &n);
         bool                    remove_neuron(uint32_t nid);
+        size_t                  remove_neurons(const std::vector<uint32_t> &nids);
         Neuron&                 get_neuron(uint32_t nid) const;
         Neuron*                 get_neuron_ptr(uint32_t nid) const;
 
@@ -220,12 +362,15 @@ namespace caspian
         void                    add_synapse(uint32_t from, uint32_t to, int16_t w, uint8_t dly = 0);
         void                    add_synapse(nlohmann::json &s);
         bool                    remove_synapse(uint32_t from, uint32_t to);
+        size_t                  remove_synapses(const std::vector<std::pair<uint32_t, uint32_t>> &pairs);
         Synapse&                get_synapse(uint32_t from, uint32_t to) const;
         Synapse&                get_synapse(uint32_t from, Neuron &to) const;
         Synapse*                get_synapse_ptr(uint32_t from, uint32_t to) const;
 
         /* Network metrics (i.e. neuron count) */
         double                  get_metric(const std::string &metric);
+        const NetworkStats&     get_stats() const;
+        void                    rebuild_stats();
 
         /* "STL"-like data structure functionality */
         NeuronTable::iterator   begin();
@@ -262,13 +407,12 @@ namespace caspian
         std::vector<uint32_t> m_neuron_ids;
         std::vector<std::pair<uint32_t, uint32_t>> m_synapse_pairs;
 
-        /* synapse metrics -- expensive run time cost */
-        int positive_synapses() const;
-        int negative_synapses() const;
-
         /* copying neurons can be problematic -- don't let the public do it */
         void add_neuron(Neuron &n);
 
+        /* appends a synapse which must not already exist -- skips all lookups */
+        Synapse* insert_synapse(Neuron *pre, Neuron *post, int16_t w, uint8_t dly);
+
         /* dimensions of the 'grid' of elements */
         size_t   m_max_size = 0;
 
@@ -277,10 +421,20 @@ namespace caspian
 
         /* total number of synapses within the network */
         int      m_num_synapses = 0;
+
+        /* incrementally maintained structural statistics */
+        NetworkStats m_stats;
         
         friend class Simulator;
     };
 
+    /* Generates count random networks of the given size using num_threads threads (<= 0 uses
+     * every core). Network i is seeded from (seed, i) only, so the population is identical
+     * for any thread count. The caller owns the returned networks. */
+    std::vector<Network*> make_random_networks(size_t count, size_t size, uint64_t seed,
+                                               const RandomNetworkParams &params,
+                                               int num_threads = 0);
+
 }
 
 /* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
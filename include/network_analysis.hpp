@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "robinhood/robin_map.h"
+#include "network.hpp"
+
+namespace caspian
+{
+    /* Fixed-size bitset indexed by dense neuron index */
+    class Bitset
+    {
+    public:
+        Bitset(size_t n = 0) : m_size(n), m_words((n + 63) / 64, 0) {}
+
+        inline void set(size_t i) { m_words[i >> 6] |= (uint64_t(1) << (i & 63)); }
+        inline void reset(size_t i) { m_words[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+        inline bool test(size_t i) const { return (m_words[i >> 6] >> (i & 63)) & 1; }
+        inline size_t size() const { return m_size; }
+
+        size_t count() const;
+
+        Bitset& operator&=(const Bitset &rhs);
+        Bitset& operator|=(const Bitset &rhs);
+
+    private:
+        size_t m_size;
+        std::vector<uint64_t> m_words;
+    };
+
+    /* Graph analysis over a snapshot of a network. Neurons are assigned dense indices (in the
+     * order of Network::get_neuron_list()) and the connectivity is flattened into CSR arrays
+     * so traversals are iterative and do not touch the neuron hash table or neuron state.
+     * The analysis does not track later changes to the network. */
+    class NetworkAnalysis
+    {
+    public:
+        NetworkAnalysis(const Network &net);
+
+        /* Dense index <-> neuron id */
+        size_t size() const;
+        const std::vector<uint32_t>& ids() const;
+        int64_t index_of(uint32_t nid) const;
+
+        /* Neurons reachable by following synapses forward from the inputs */
+        Bitset forward_reachable() const;
+
+        /* Neurons from which an output can be reached */
+        Bitset backward_reachable() const;
+
+        /* Neurons which are both -- the only ones able to influence outputs */
+        Bitset live() const;
+
+        /* Generic traversals from a set of dense indices */
+        Bitset reach_forward(const std::vector<uint32_t> &seeds) const;
+        Bitset reach_backward(const std::vector<uint32_t> &seeds) const;
+
+        /* Convert a bitset back to a list of neuron ids */
+        std::vector<uint32_t> to_ids(const Bitset &b) const;
+
+    private:
+        Bitset traverse(const std::vector<uint32_t> &seeds,
+                        const std::vector<uint32_t> &offsets,
+                        const std::vector<uint32_t> &edges) const;
+
+        std::vector<uint32_t> m_ids;
+        tsl::robin_map<uint32_t, uint32_t> m_index;
+
+        /* CSR adjacency in both directions */
+        std::vector<uint32_t> m_out_offsets, m_out_edges;
+        std::vector<uint32_t> m_in_offsets, m_in_edges;
+
+        /* dense indices of the i/o neurons */
+        std::vector<uint32_t> m_inputs, m_outputs;
+    };
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -6,4 +6,9 @@ namespace caspian
 {
     bool network_framework_to_internal(neuro::Network *tn, caspian::Network *net);
     bool network_internal_to_framework(caspian::Network *net, neuro::Network *tn);
+
+    /* Content fingerprint of a framework network (structure, values, and i/o). This is a
+     * read-only walk which is much cheaper than a conversion and is used to decide whether a
+     * previously converted network can be reused. */
+    uint64_t network_framework_fingerprint(neuro::Network *tn);
 }
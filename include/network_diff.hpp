@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "network.hpp"
+
+namespace caspian
+{
+    /* The changes which turn a base network into a target network. Produced by
+     * target.diff(base) and applied with net.apply_patch(diff) on a copy of the base. Only
+     * the elements which differ are stored, so a mutant of a large network is typically a
+     * few bytes in binary form. The structural hashes of both networks are recorded so a
+     * patch cannot silently be applied to the wrong base. */
+    struct NetworkDiff
+    {
+        struct NeuronEntry
+        {
+            uint32_t id;
+            int16_t threshold;
+            int8_t leak;
+            uint8_t delay;
+        };
+
+        struct SynapseEntry
+        {
+            uint32_t from;
+            uint32_t to;
+            int16_t weight;
+            uint8_t delay;
+        };
+
+        /* structural hashes (see Network::structural_hash()) */
+        uint64_t base_hash = 0;
+        uint64_t target_hash = 0;
+
+        /* removed neurons take all of their synapses with them */
+        std::vector<uint32_t> removed_neurons;
+        std::vector<std::pair<uint32_t, uint32_t>> removed_synapses;
+
+        /* added or changed elements */
+        std::vector<NeuronEntry> neurons;
+        std::vector<SynapseEntry> synapses;
+
+        /* the i/o mapping is only sent when it changed */
+        bool io_changed = false;
+        std::vector<int32_t> inputs;
+        std::vector<int32_t> outputs;
+
+        /* target configuration */
+        uint16_t max_thresh = 0;
+        bool soft_reset = false;
+        uint8_t max_syn_delay = 0;
+        uint8_t max_axon_delay = 0;
+
+        /* true if no element or i/o changes are present */
+        bool empty() const;
+
+        /* Compact binary encoding (same primitives as Network::to_bytes) */
+        std::vector<uint8_t> to_bytes() const;
+        void to_bytes(std::vector<uint8_t> &buf) const;
+        size_t from_bytes(const uint8_t *data, size_t len);
+    };
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+#include "network.hpp"
+
+namespace caspian
+{
+    /* What a single optimizer pass changed */
+    struct OptimizerPassReport
+    {
+        std::string name;
+        size_t neurons_removed = 0;
+        size_t synapses_removed = 0;
+        size_t synapses_added = 0;
+    };
+
+    struct OptimizerReport
+    {
+        std::vector<OptimizerPassReport> passes;
+        size_t neurons_before = 0;
+        size_t synapses_before = 0;
+        size_t neurons_after = 0;
+        size_t synapses_after = 0;
+
+        nlohmann::json to_json() const;
+    };
+
+    /* Network optimizer -- removes or folds structures which cannot change when (or whether)
+     * an output neuron fires. The passes, in order:
+     *
+     *   zero_weight_synapses  synapses with weight 0 into non-leaky neurons (hard reset only)
+     *   silent_neurons        non-input neurons with no positive incoming weight never fire
+     *   unreachable_neurons   hidden neurons which are not both reachable from an input and
+     *                         able to reach an output
+     *   relay_chains          hidden neurons with a single incoming synapse strong enough to
+     *                         always fire are folded into their pre-synaptic neuron by
+     *                         lengthening the synaptic delay (bounded by MAX_DELAY)
+     *
+     * Output spike timing is preserved exactly. Internal activity (spike rasters, charges, and
+     * fire/accumulate metrics) reflects the reduced network. The network is expected to be in
+     * a reset state. */
+    OptimizerReport optimize_network(Network &net);
+
+    /* Individual passes -- each returns what it removed */
+    OptimizerPassReport remove_zero_weight_synapses(Network &net);
+    OptimizerPassReport remove_silent_neurons(Network &net);
+    OptimizerPassReport remove_unreachable_neurons(Network &net);
+    OptimizerPassReport fold_relay_chains(Network &net);
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <list>
 #include <map>
 
 #include "framework.hpp"
 #include "backend.hpp"
 #include "network.hpp"
 #include "network_conversion.hpp"
+#include "optimizer.hpp"
 #include "nlohmann/json.hpp"
 
 namespace caspian
@@ -15,6 +18,26 @@ namespace caspian
     using neuro::Spike;
     using nlohmann::json;
 
+    /* Readout order of a loaded network: the framework node ids in sorted order (as in
+     * neuro::Network::sorted_node_vector) and the matching internal neurons, which are
+     * nullptr for neurons removed by the optimizer. Built once when a network is converted. */
+    struct NeuronIndex
+    {
+        vector<uint32_t> ids;
+        vector<caspian::Neuron*> neurons;
+        vector<int32_t> table;  // id -> position (empty if the ids are too sparse)
+
+        /* position of a node id, -1 if it is not part of the network */
+        int32_t position(uint32_t id) const
+        {
+            if(!table.empty())
+                return (id < table.size()) ? table[id] : -1;
+
+            auto it = std::lower_bound(ids.begin(), ids.end(), id);
+            return (it != ids.end() && *it == id) ? int32_t(it - ids.begin()) : -1;
+        }
+    };
+
     class Processor : public neuro::Processor
     {
     public:
@@ -25,23 +48,29 @@ namespace caspian
         bool load_network(neuro::Network* n, int network_id = 0);
         bool load_networks(vector<neuro::Network*>& n);
 
-        /* Apply spike(s) to a network */
+        /* Apply spike(s) to a network -- with networks loaded by load_networks, these
+         * overloads apply the spike(s) to every network of the batch */
         void apply_spike(const Spike& s,
                          bool normalized = true,
                          int network_id = 0);
-        void apply_spike(const Spike& s,
-                         const vector<int>& network_ids,
-                         bool normalized = true);
-
-        /* Apply spike(s) to multiple networks */
         void apply_spikes(const vector<Spike>& spikes,
                           bool normalized = true,
                           int network_id = 0);
+        void apply_spikes(const Spike *spikes,
+                          size_t count,
+                          bool normalized = true,
+                          int network_id = 0);
+
+        /* Apply spike(s) to the listed networks of a batch only */
+        void apply_spike(const Spike& s,
+                         const vector<int>& network_ids,
+                         bool normalized = true);
         void apply_spikes(const vector<Spike>& spikes,
                           const vector<int>& network_ids,
                           bool normalized = true);
 
-        /* Run the network for the desired time with queued input(s) */
+        /* Run the network for the desired time with queued input(s). The networks of a
+         * batch share a clock, so running any of them runs the whole batch. */
         void run(double duration, int network_id = 0);
         void run(double duration, const vector<int>& network_ids);
 
@@ -68,6 +97,16 @@ namespace caspian
         vector <double> neuron_last_fires(int network_id = 0);
         vector < vector <double> > neuron_vectors(int network_id = 0);
         vector < double > neuron_charges(int network_id = 0);
+
+        /* Bulk readouts into caller-provided buffers of num_readout_neurons() entries, in
+         * the order of the vector versions above. Null buffers are skipped; all requested
+         * readouts are filled in a single pass over the spikes of the last run. */
+        size_t num_readout_neurons(int network_id = 0) const;
+        void read_neuron_activity(int *counts, double *last_fires, double *charges, int network_id = 0);
+
+        /* Spike counts of the last run split into num_bins equal time bins of a run of
+         * duration cycles -- counts holds (num_readout_neurons() x num_bins) entries */
+        void read_neuron_bins(int *counts, size_t num_bins, uint64_t duration, int network_id = 0);
         void synapse_weights (vector <uint32_t> &pres,
                                   vector <uint32_t> &posts,
                                   vector <double> &vals,
@@ -99,7 +138,38 @@ namespace caspian
         json get_configuration() const;
         caspian::Backend* get_backend() const;
 
+        /* What the optimizer removed from a loaded network (empty unless "Optimize" is set) */
+        json get_optimizer_report(int network_id = 0) const;
+
     protected:
+        /* Converted (and optimized) networks are cached by framework network pointer and
+         * content fingerprint, so reloading an unchanged network skips the conversion.
+         * Entries in use by the current load are never evicted. */
+        struct CachedNetwork
+        {
+            neuro::Network *api = nullptr;
+            uint64_t fingerprint = 0;
+            caspian::Network *net = nullptr;
+            OptimizerReport report;
+            NeuronIndex index;
+            bool in_use = false;
+        };
+
+        /* fills api_nets/internal_nets from the cache, converting misses in parallel */
+        bool convert_networks(vector<neuro::Network*> &nets);
+
+        /* drops the current networks (cached ones stay in the cache) */
+        void release_networks();
+
+        /* device charge for a spike, checking the range of unnormalized values */
+        int16_t spike_value(const Spike& s, bool normalized) const;
+
+        /* converts spikes into the staging buffers for Backend::apply_inputs */
+        void stage_spikes(const Spike *spikes, size_t count, bool normalized);
+
+        /* throws if any of the ids does not refer to a loaded network */
+        void check_network_ids(const vector<int>& network_ids, const string &caller) const;
+
         caspian::Backend* dev;
 
         json jconfig;
@@ -110,6 +180,19 @@ namespace caspian
         bool multi_net_sim = false;
         vector<neuro::Network*> api_nets;
         vector<caspian::Network*> internal_nets;
+        vector<OptimizerReport> opt_reports;
+
+        /* most recently used first */
+        std::list<CachedNetwork> net_cache;
+        /* conversions which are not in the cache (duplicates, cache disabled) */
+        std::list<CachedNetwork> owned_nets;
+        /* readout order of each loaded network (points into the entries above) */
+        vector<const NeuronIndex*> readouts;
+
+        /* staging buffers for bulk input injection */
+        vector<int> staged_ids;
+        vector<int16_t> staged_weights;
+        vector<uint64_t> staged_times;
     };
 
 }
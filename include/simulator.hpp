@@ -67,6 +67,13 @@ namespace caspian
         std::vector<std::vector<uint32_t>> recorded_fires;
     };
 
+    /* Fire and accumulate counts of a single network */
+    struct ActivityCounters
+    {
+        uint64_t fires = 0;
+        uint64_t accumulates = 0;
+    };
+
     /* The simluator implements the "Backend" interface. This simulator is single-threaded 
      * following a hybrid-event simulation model which loops through each timestep but only 
      * performs the necessary work at each step using a circular-buffer inspired event queue
@@ -78,6 +85,7 @@ namespace caspian
         /* processes a selected fire event */
         void process_fire(const FireEvent &e) noexcept;
         void process_fire(const InputFireEvent &e);
+        void process_input(Network *n, const InputFireEvent &e);
 
         /* Updates last event & leak for a neuron */
         void refresh_neuron(Neuron *n) noexcept;
@@ -88,6 +96,9 @@ namespace caspian
         /* executes a single cycle of the simulation */
         void do_cycle();
 
+        /* pre-sizes the event buckets from the network statistics */
+        void reserve_buckets(size_t fan_out, size_t neurons);
+
         /* id -> element coordinates for inputs */
         std::vector<uint32_t> input_map;
 
@@ -107,9 +118,8 @@ namespace caspian
         /* collection of input fires organized by time */
         std::vector<InputFireEvent> input_fires;
 
-        /* hacked up spike raster */
-        std::vector<std::vector<uint32_t>> all_spikes;
-        UIntMap all_spike_cnts;
+        /* spike raster */
+        SpikeBuffer all_spikes;
 
         /* stores the currently loaded network */
         std::vector<Network*> nets; // if multiple are loaded, all are here -- first is also stored in *net
@@ -117,8 +127,18 @@ namespace caspian
 
         /* metrics for Neuro GetMetric() */
         uint64_t metric_timesteps = 0;
-        int metric_accumulates = 0;
-        int metric_fires = 0;
+
+        /* activity of each network since it was configured, indexed by Neuron::tag */
+        std::vector<ActivityCounters> activity;
+        /* activity at the start of the last simulate() call */
+        std::vector<ActivityCounters> run_start_activity;
+        /* get_metric() resets on read: activity already reported and activity of
+         * previous configurations which was never read */
+        ActivityCounters metric_read;
+        ActivityCounters metric_unread;
+
+        /* sum of the activity counters of all networks */
+        ActivityCounters total_activity() const;
 
         /* Network time at the start of a simulation call */
         uint64_t run_start_time = 0;
@@ -145,8 +165,13 @@ namespace caspian
         Simulator(bool debug = false);
         ~Simulator() = default;
 
-        /* Queue fires into the array */
+        /* Queue fires into the array (every network of a batch receives the fire) */
         void apply_input(int input_id, int16_t w, uint64_t t);
+        /* Queue a fire for a single network of a batch */
+        void apply_input(int input_id, int16_t w, uint64_t t, int network_id);
+        /* Queue many fires at once */
+        void apply_inputs(const int *input_ids, const int16_t *w, const uint64_t *t,
+                          size_t count, int network_id = -1);
 
         /* Set the network to execute */
         bool configure(Network *network);
@@ -159,6 +184,7 @@ namespace caspian
         /* Get device metrics */
         double get_metric(const std::string &metric);
         uint64_t get_metric_uint(const std::string &metric);
+        double get_network_metric(const std::string &metric, int network_id);
 
         /* Get the current time */
         uint64_t get_time() const;
@@ -184,6 +210,7 @@ namespace caspian
         void collect_all_spikes(bool collect = true); 
         std::vector<std::vector<uint32_t>> get_all_spikes();
         UIntMap get_all_spike_cnts();
+        const SpikeBuffer& get_spike_buffer() const;
     };
 }
 
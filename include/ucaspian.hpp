@@ -114,6 +114,9 @@ namespace caspian
 
         /* Queue fires into the array */
         void apply_input(int input_id, int16_t w, uint64_t t);
+        void apply_input(int input_id, int16_t w, uint64_t t, int network_id);
+        void apply_inputs(const int *input_ids, const int16_t *w, const uint64_t *t,
+                          size_t count, int network_id = -1);
 
         /* Set the network to execute */
         bool configure(Network *network);
@@ -125,6 +128,7 @@ namespace caspian
 
         /* Get device metrics */
         double get_metric(const std::string &metric);
+        double get_network_metric(const std::string &metric, int network_id);
 
         /* Get the current time */
         uint64_t get_time() const;
@@ -150,6 +154,7 @@ namespace caspian
         void collect_all_spikes(bool collect = true); 
         std::vector<std::vector<uint32_t>> get_all_spikes();
         UIntMap get_all_spike_cnts();
+        const SpikeBuffer& get_spike_buffer() const;
     };
 #endif
 
@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace caspian
+{
+    /* A fixed set of worker threads which are started once and reused. Each call to run()
+     * hands the same job to every worker (along with its index) and blocks until all of
+     * them return, so per-worker state (processors, scratch buffers) can live in vectors
+     * indexed by worker. Jobs typically pull their work items off a shared queue. */
+    class WorkerPool
+    {
+    public:
+        using Job = std::function<void(int)>;
+
+        /* num_threads <= 0 uses the hardware concurrency */
+        explicit WorkerPool(int num_threads = 0)
+        {
+            if(num_threads <= 0)
+                num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+            for(int i = 0; i < num_threads; i++)
+                m_threads.emplace_back(&WorkerPool::worker, this, i);
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_stop = true;
+            }
+            m_start.notify_all();
+
+            for(auto &t : m_threads)
+                t.join();
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        int size() const { return m_threads.size(); }
+
+        /* Runs job(worker_index) on every worker and waits for all of them. The first
+         * exception thrown by a worker is rethrown here. Calls are serialized. */
+        void run(const Job &job)
+        {
+            std::lock_guard<std::mutex> run_lock(m_run_mtx);
+            std::unique_lock<std::mutex> lock(m_mtx);
+
+            m_job = &job;
+            m_error = nullptr;
+            m_running = m_threads.size();
+            m_generation++;
+            m_start.notify_all();
+
+            m_done.wait(lock, [this]() { return m_running == 0; });
+            m_job = nullptr;
+
+            if(m_error)
+            {
+                std::exception_ptr e = m_error;
+                m_error = nullptr;
+                std::rethrow_exception(e);
+            }
+        }
+
+    private:
+        void worker(int idx)
+        {
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> lock(m_mtx);
+
+            while(true)
+            {
+                m_start.wait(lock, [&]() { return m_stop || m_generation != seen; });
+                if(m_stop) return;
+
+                seen = m_generation;
+                const Job *job = m_job;
+                lock.unlock();
+
+                std::exception_ptr error;
+                try
+                {
+                    (*job)(idx);
+                }
+                catch(...)
+                {
+                    error = std::current_exception();
+                }
+
+                lock.lock();
+                if(error && !m_error) m_error = error;
+                if(--m_running == 0) m_done.notify_all();
+            }
+        }
+
+        std::vector<std::thread> m_threads;
+        std::mutex m_run_mtx;
+        std::mutex m_mtx;
+        std::condition_variable m_start;
+        std::condition_variable m_done;
+        const Job *m_job = nullptr;
+        std::exception_ptr m_error;
+        uint64_t m_generation = 0;
+        size_t m_running = 0;
+        bool m_stop = false;
+    };
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -0,0 +1,233 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.hpp"
+#include "byte_stream.hpp"
+
+namespace caspian
+{
+    PopulationArchiveWriter::PopulationArchiveWriter(const std::string &path) :
+        m_out(path, std::ios::binary | std::ios::trunc)
+    {
+        if(!m_out)
+            throw std::runtime_error("[archive] Could not open '" + path + "' for writing");
+
+        // placeholder header -- filled in by close()
+        std::vector<uint8_t> header(archive::HEADER_SIZE, 0);
+        m_out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        m_offset = archive::HEADER_SIZE;
+    }
+
+    PopulationArchiveWriter::~PopulationArchiveWriter()
+    {
+        try
+        {
+            close();
+        }
+        catch(...)
+        {
+            // destructors must not throw -- call close() explicitly to see errors
+        }
+    }
+
+    size_t PopulationArchiveWriter::add(const Network &net)
+    {
+        if(m_closed)
+            throw std::runtime_error("[archive] Cannot add a network to a closed archive");
+
+        m_buf.clear();
+        net.to_bytes(m_buf);
+        m_out.write(reinterpret_cast<const char*>(m_buf.data()), m_buf.size());
+
+        m_index.emplace_back(m_offset, m_buf.size());
+        m_offset += m_buf.size();
+
+        return m_index.size() - 1;
+    }
+
+    void PopulationArchiveWriter::close()
+    {
+        if(m_closed) return;
+        m_closed = true;
+
+        // index follows the last record
+        uint64_t index_offset = m_offset;
+
+        m_buf.clear();
+        ByteWriter w(m_buf);
+        for(auto const &entry : m_index)
+        {
+            w.u64(entry.first);
+            w.u64(entry.second);
+        }
+        m_out.write(reinterpret_cast<const char*>(m_buf.data()), m_buf.size());
+
+        // header
+        m_buf.clear();
+        w.bytes(archive::MAGIC, sizeof(archive::MAGIC));
+        w.u32(archive::VERSION);
+        w.u32(0);
+        w.u64(m_index.size());
+        w.u64(index_offset);
+
+        m_out.seekp(0);
+        m_out.write(reinterpret_cast<const char*>(m_buf.data()), m_buf.size());
+        m_out.close();
+
+        if(m_out.fail())
+            throw std::runtime_error("[archive] Error while writing archive");
+    }
+
+    void write_population_archive(const std::string &path, const std::vector<Network*> &networks)
+    {
+        PopulationArchiveWriter writer(path);
+
+        for(const Network *net : networks)
+            writer.add(*net);
+
+        writer.close();
+    }
+
+    PopulationArchive::PopulationArchive(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw std::runtime_error("[archive] Could not open '" + path + "'");
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || size_t(st.st_size) < archive::HEADER_SIZE)
+        {
+            ::close(fd);
+            throw std::runtime_error("[archive] '" + path + "' is not a population archive");
+        }
+
+        m_len = st.st_size;
+        void *p = mmap(nullptr, m_len, PROT_READ, MAP_SHARED, fd, 0);
+
+        // the mapping stays valid after the descriptor is closed
+        ::close(fd);
+
+        if(p == MAP_FAILED)
+            throw std::runtime_error("[archive] Could not map '" + path + "'");
+
+        m_data = static_cast<const uint8_t*>(p);
+
+        try
+        {
+            ByteReader r(m_data, m_len);
+
+            if(std::memcmp(r.bytes(sizeof(archive::MAGIC)), archive::MAGIC, sizeof(archive::MAGIC)) != 0)
+                throw std::runtime_error("[archive] '" + path + "' is not a population archive");
+
+            if(r.u32() != archive::VERSION)
+                throw std::runtime_error("[archive] '" + path + "' has an unsupported version");
+
+            r.u32();
+            m_count = r.u64();
+            uint64_t index_offset = r.u64();
+
+            if(index_offset > m_len || (m_len - index_offset) / archive::INDEX_ENTRY_SIZE < m_count)
+                throw std::runtime_error("[archive] '" + path + "' is truncated");
+
+            m_index = m_data + index_offset;
+        }
+        catch(...)
+        {
+            unmap();
+            throw;
+        }
+    }
+
+    PopulationArchive::~PopulationArchive()
+    {
+        unmap();
+    }
+
+    PopulationArchive::PopulationArchive(PopulationArchive &&a) noexcept :
+        m_data(a.m_data), m_len(a.m_len), m_count(a.m_count), m_index(a.m_index)
+    {
+        a.m_data = nullptr;
+        a.m_len = 0;
+        a.m_count = 0;
+        a.m_index = nullptr;
+    }
+
+    PopulationArchive& PopulationArchive::operator=(PopulationArchive &&a) noexcept
+    {
+        if(&a == this) return *this;
+
+        unmap();
+        m_data = a.m_data;
+        m_len = a.m_len;
+        m_count = a.m_count;
+        m_index = a.m_index;
+
+        a.m_data = nullptr;
+        a.m_len = 0;
+        a.m_count = 0;
+        a.m_index = nullptr;
+
+        return *this;
+    }
+
+    void PopulationArchive::unmap()
+    {
+        if(m_data != nullptr)
+            munmap(const_cast<uint8_t*>(m_data), m_len);
+
+        m_data = nullptr;
+        m_len = 0;
+        m_count = 0;
+        m_index = nullptr;
+    }
+
+    size_t PopulationArchive::size() const
+    {
+        return m_count;
+    }
+
+    std::pair<const uint8_t*, size_t> PopulationArchive::record(size_t idx) const
+    {
+        if(idx >= m_count)
+            throw std::out_of_range("[archive] Network index " + std::to_string(idx) + " is out of range");
+
+        ByteReader r(m_index + idx * archive::INDEX_ENTRY_SIZE, archive::INDEX_ENTRY_SIZE);
+        uint64_t offset = r.u64();
+        uint64_t size = r.u64();
+
+        if(offset > m_len || size > m_len - offset)
+            throw std::runtime_error("[archive] Record " + std::to_string(idx) + " is corrupt");
+
+        return std::make_pair(m_data + offset, size);
+    }
+
+    void PopulationArchive::load(size_t idx, Network &net) const
+    {
+        auto rec = record(idx);
+        net.from_bytes(rec.first, rec.second);
+    }
+
+    Network* PopulationArchive::load(size_t idx) const
+    {
+        Network *net = new Network();
+
+        try
+        {
+            load(idx, *net);
+        }
+        catch(...)
+        {
+            delete net;
+            throw;
+        }
+
+        return net;
+    }
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dvs.hpp"
+
+namespace caspian
+{
+    DvsConverter::DvsConverter(const DvsConfig &config) : m_cfg(config)
+    {
+        if(m_cfg.width == 0 || m_cfg.height == 0)
+            throw std::invalid_argument("[DvsConverter] width and height must be positive");
+        if(m_cfg.downsample == 0)
+            throw std::invalid_argument("[DvsConverter] downsample must be positive");
+        if(!(m_cfg.time_bin > 0))
+            throw std::invalid_argument("[DvsConverter] time_bin must be positive");
+
+        m_out_width = (m_cfg.width + m_cfg.downsample - 1) / m_cfg.downsample;
+        m_out_height = (m_cfg.height + m_cfg.downsample - 1) / m_cfg.downsample;
+
+        if(m_cfg.refractory > 0)
+            m_ready.assign(num_inputs(), 0);
+    }
+
+    uint32_t DvsConverter::num_inputs() const
+    {
+        return m_out_width * m_out_height * (m_cfg.use_polarity ? 2 : 1);
+    }
+
+    size_t DvsConverter::convert(const int32_t *x, const int32_t *y, const int32_t *p, const double *t, size_t n,
+                                 std::vector<int> &ids, std::vector<int16_t> &charges, std::vector<uint64_t> &times,
+                                 uint64_t base_cycle)
+    {
+        if(m_cfg.use_polarity && p == nullptr && n > 0)
+            throw std::invalid_argument("[DvsConverter] Polarity is required with use_polarity");
+
+        const uint32_t ds = m_cfg.downsample;
+        const uint32_t frame = m_out_width * m_out_height;
+        const double inv_bin = 1.0 / m_cfg.time_bin;
+        const bool refractory = (m_cfg.refractory > 0);
+
+        ids.clear();
+        times.clear();
+        ids.reserve(n);
+        times.reserve(n);
+
+        for(size_t i = 0; i < n; i++)
+        {
+            if(uint32_t(x[i]) >= m_cfg.width || uint32_t(y[i]) >= m_cfg.height)
+                throw std::out_of_range("[DvsConverter] Event " + std::to_string(i) + " at (" +
+                        std::to_string(x[i]) + ", " + std::to_string(y[i]) + ") is outside the sensor");
+
+            double rel = t[i] - m_cfg.time_offset;
+            if(rel < 0) continue;
+
+            uint64_t cycle = uint64_t(rel * inv_bin);
+            if(cycle < base_cycle) continue;
+
+            uint32_t id = (uint32_t(y[i]) / ds) * m_out_width + uint32_t(x[i]) / ds;
+            if(m_cfg.use_polarity && p[i] > 0) id += frame;
+
+            if(refractory)
+            {
+                if(cycle < m_ready[id]) continue;
+                m_ready[id] = cycle + m_cfg.refractory;
+            }
+
+            ids.push_back(id);
+            times.push_back(cycle - base_cycle);
+        }
+
+        charges.assign(ids.size(), m_cfg.charge);
+        return ids.size();
+    }
+
+    size_t DvsConverter::apply(Backend *dev, const int32_t *x, const int32_t *y, const int32_t *p, const double *t,
+                               size_t n, int network_id, uint64_t base_cycle)
+    {
+        size_t kept = convert(x, y, p, t, n, m_ids, m_charges, m_times, base_cycle);
+        dev->apply_inputs(m_ids.data(), m_charges.data(), m_times.data(), kept, network_id);
+        return kept;
+    }
+
+    uint64_t DvsConverter::cycle_of(double t) const
+    {
+        double rel = t - m_cfg.time_offset;
+        return (rel > 0) ? uint64_t(rel / m_cfg.time_bin) : 0;
+    }
+
+    void DvsConverter::reset()
+    {
+        std::fill(m_ready.begin(), m_ready.end(), 0);
+    }
+
+    uint64_t DvsField::read(const uint8_t *record) const
+    {
+        uint64_t v = 0;
+        const uint8_t *b = record + offset;
+
+        if(big_endian)
+            for(uint32_t i = 0; i < bytes; i++) v = (v << 8) | b[i];
+        else
+            for(uint32_t i = bytes; i > 0; i--) v = (v << 8) | b[i-1];
+
+        v >>= shift;
+        return (bits < 64) ? (v & ((uint64_t(1) << bits) - 1)) : v;
+    }
+
+    DvsLayout DvsLayout::nmnist()
+    {
+        DvsLayout l;
+        l.record_size = 5;
+
+        l.x.offset = 0;
+        l.x.bytes = 1;
+
+        l.y.offset = 1;
+        l.y.bytes = 1;
+
+        l.p.offset = 2;
+        l.p.bytes = 1;
+        l.p.shift = 7;
+        l.p.bits = 1;
+
+        l.t.offset = 2;
+        l.t.bytes = 3;
+        l.t.bits = 23;
+        l.t.big_endian = true;
+
+        return l;
+    }
+
+    DvsFile::DvsFile(const std::string &path, const DvsLayout &layout) : m_layout(layout)
+    {
+        const DvsField *fields[4] = {&m_layout.x, &m_layout.y, &m_layout.p, &m_layout.t};
+
+        if(m_layout.record_size == 0)
+            throw std::invalid_argument("[DvsFile] record_size must be positive");
+        for(const DvsField *f : fields)
+            if(f->bytes > 8 || f->offset + f->bytes > m_layout.record_size)
+                throw std::invalid_argument("[DvsFile] A field does not fit in the record");
+        for(const DvsField *f : fields)
+            if(f->shift >= 64 || f->bits == 0 || f->bits > 64)
+                throw std::invalid_argument("[DvsFile] A field has an invalid shift or bit width");
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw std::runtime_error("[DvsFile] Could not open '" + path + "'");
+
+        struct stat st;
+        if(fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("[DvsFile] Could not stat '" + path + "'");
+        }
+
+        m_len = st.st_size;
+
+        // a trailing partial record is ignored
+        m_count = (m_len > m_layout.header) ? (m_len - m_layout.header) / m_layout.record_size : 0;
+
+        if(m_len > 0)
+        {
+            void *p = mmap(nullptr, m_len, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+
+            if(p == MAP_FAILED)
+                throw std::runtime_error("[DvsFile] Could not map '" + path + "'");
+
+            m_data = static_cast<const uint8_t*>(p);
+
+            // windows are read front to back
+            madvise(p, m_len, MADV_SEQUENTIAL);
+        }
+        else
+            ::close(fd);
+    }
+
+    DvsFile::~DvsFile()
+    {
+        if(m_data != nullptr)
+            munmap(const_cast<uint8_t*>(m_data), m_len);
+    }
+
+    double DvsFile::time(size_t i) const
+    {
+        if(i >= m_count)
+            throw std::out_of_range("[DvsFile] Event index " + std::to_string(i) + " is out of range");
+
+        return m_layout.t.read(record(i)) * m_layout.time_scale;
+    }
+
+    size_t DvsFile::find(double t) const
+    {
+        size_t lo = 0, hi = m_count;
+
+        while(lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if(m_layout.t.read(record(mid)) * m_layout.time_scale < t)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        return lo;
+    }
+
+    void DvsFile::read(size_t begin, size_t end, int32_t *x, int32_t *y, int32_t *p, double *t) const
+    {
+        if(begin > end || end > m_count)
+            throw std::out_of_range("[DvsFile] Event range is out of range");
+
+        for(size_t i = begin; i < end; i++)
+        {
+            const uint8_t *rec = record(i);
+
+            *x++ = m_layout.x.read(rec);
+            *y++ = m_layout.y.read(rec);
+            *p++ = m_layout.p.read(rec);
+            *t++ = m_layout.t.read(rec) * m_layout.time_scale;
+        }
+    }
+
+    size_t DvsFile::apply_window(DvsConverter &conv, Backend *dev, double t0, double t1, int network_id)
+    {
+        size_t begin = find(t0);
+        size_t end = std::max(begin, find(t1));
+        size_t n = end - begin;
+
+        m_x.resize(n);
+        m_y.resize(n);
+        m_p.resize(n);
+        m_t.resize(n);
+        read(begin, end, m_x.data(), m_y.data(), m_p.data(), m_t.data());
+
+        return conv.apply(dev, m_x.data(), m_y.data(), m_p.data(), m_t.data(), n, network_id, conv.cycle_of(t0));
+    }
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -3,15 +3,64 @@
 #include <random>
 #include <cassert>
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <exception>
 
 #include "nlohmann/json.hpp"
 
 #include "network.hpp"
+#include "network_analysis.hpp"
 #include "constants.hpp"
+#include "byte_stream.hpp"
 
 namespace caspian
 {
 
+    /* splitmix64 generator -- trivially seeded, so every network can have its own stream */
+    class SplitMix64
+    {
+    public:
+        explicit SplitMix64(uint64_t seed) : m_state(seed) {}
+
+        inline uint64_t next()
+        {
+            uint64_t r = hash_mix(m_state);
+            m_state += 0x9e3779b97f4a7c15ULL;
+            return r;
+        }
+
+        /* unbiased integer in [lo, hi] (Lemire's multiply-shift with rejection) */
+        inline int range(int lo, int hi)
+        {
+            uint32_t span = uint32_t(int64_t(hi) - int64_t(lo) + 1);
+            uint64_t m = uint64_t(uint32_t(next())) * span;
+            uint32_t l = uint32_t(m);
+
+            if(l < span)
+            {
+                uint32_t t = uint32_t(-span) % span;
+                while(l < t)
+                {
+                    m = uint64_t(uint32_t(next())) * span;
+                    l = uint32_t(m);
+                }
+            }
+
+            return lo + int(m >> 32);
+        }
+
+        /* uniform double in [0, 1) */
+        inline double uniform()
+        {
+            return double(next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+    private:
+        uint64_t m_state;
+    };
+
     std::string create_device_config(int size, int inputs, int outputs)
     {
         std::ostringstream oss;
@@ -58,6 +107,113 @@ namespace caspian
         return j;
     }
 
+    void NetworkStats::clear()
+    {
+        *this = NetworkStats();
+    }
+
+    void NetworkStats::hist_trim(std::vector<size_t> &hist)
+    {
+        while(!hist.empty() && hist.back() == 0)
+            hist.pop_back();
+    }
+
+    void NetworkStats::hist_move(std::vector<size_t> &hist, size_t from, size_t to)
+    {
+        if(to >= hist.size())
+            hist.resize(to + 1, 0);
+
+        hist[from]--;
+        hist[to]++;
+        hist_trim(hist);
+    }
+
+    void NetworkStats::add_neuron(uint8_t delay)
+    {
+        if(m_fan_in_hist.empty()) m_fan_in_hist.resize(1, 0);
+        if(m_fan_out_hist.empty()) m_fan_out_hist.resize(1, 0);
+
+        m_fan_in_hist[0]++;
+        m_fan_out_hist[0]++;
+        m_axon_delay_hist[delay]++;
+        m_axon_delay_sum += delay;
+        m_neurons++;
+    }
+
+    void NetworkStats::remove_neuron(size_t fan_in, size_t fan_out, uint8_t delay)
+    {
+        m_fan_in_hist[fan_in]--;
+        m_fan_out_hist[fan_out]--;
+        hist_trim(m_fan_in_hist);
+        hist_trim(m_fan_out_hist);
+
+        m_axon_delay_hist[delay]--;
+        m_axon_delay_sum -= delay;
+        m_neurons--;
+    }
+
+    void NetworkStats::change_neuron(uint8_t old_delay, uint8_t new_delay)
+    {
+        m_axon_delay_hist[old_delay]--;
+        m_axon_delay_hist[new_delay]++;
+        m_axon_delay_sum += new_delay;
+        m_axon_delay_sum -= old_delay;
+    }
+
+    void NetworkStats::add_synapse(int16_t weight, uint8_t delay)
+    {
+        if(weight > 0) m_positive++;
+        if(weight < 0) m_negative++;
+
+        m_syn_delay_hist[delay]++;
+        m_syn_delay_sum += delay;
+        m_synapses++;
+    }
+
+    void NetworkStats::remove_synapse(int16_t weight, uint8_t delay)
+    {
+        if(weight > 0) m_positive--;
+        if(weight < 0) m_negative--;
+
+        m_syn_delay_hist[delay]--;
+        m_syn_delay_sum -= delay;
+        m_synapses--;
+    }
+
+    void NetworkStats::move_fan_in(size_t from, size_t to)
+    {
+        hist_move(m_fan_in_hist, from, to);
+    }
+
+    void NetworkStats::move_fan_out(size_t from, size_t to)
+    {
+        hist_move(m_fan_out_hist, from, to);
+    }
+
+    size_t NetworkStats::max_synapse_delay() const
+    {
+        for(size_t d = m_syn_delay_hist.size(); d > 0; d--)
+            if(m_syn_delay_hist[d-1] != 0) return d-1;
+        return 0;
+    }
+
+    size_t NetworkStats::max_axon_delay() const
+    {
+        for(size_t d = m_axon_delay_hist.size(); d > 0; d--)
+            if(m_axon_delay_hist[d-1] != 0) return d-1;
+        return 0;
+    }
+
+    double NetworkStats::mean_synapse_delay() const
+    {
+        return (m_synapses == 0) ? 0 : double(m_syn_delay_sum) / m_synapses;
+    }
+
+    double NetworkStats::mean_axon_delay() const
+    {
+        return (m_neurons == 0) ? 0 : double(m_axon_delay_sum) / m_neurons;
+    }
+
     Network::Network(size_t max_size) : m_max_size(max_size)
     {
         elements.reserve(m_max_size);
@@ -70,7 +226,6 @@ namespace caspian
         m_max_size = n.m_max_size;
         m_inputs = n.m_inputs;
         m_outputs = n.m_outputs;
-        m_neuron_ids = n.m_neuron_ids;
         m_synapse_pairs = n.m_synapse_pairs;
         m_num_synapses = n.m_num_synapses;
         m_time = 0;
@@ -79,10 +234,14 @@ namespace caspian
         max_thresh = n.max_thresh;
         soft_reset = n.soft_reset;
         elements.clear();
+        m_stats.clear();
 
         for(auto const &elm : n.elements)
             add_neuron(*(elm.second));
 
+        // add_neuron appends ids in table order -- keep the original ordering instead
+        m_neuron_ids = n.m_neuron_ids;
+
         // update element synapse pointers
         for(auto &&elm : elements)
         {
@@ -101,7 +260,6 @@ namespace caspian
         m_max_size = n.m_max_size;
         m_inputs = n.m_inputs;
         m_outputs = n.m_outputs;
-        m_neuron_ids = n.m_neuron_ids;
         m_synapse_pairs = n.m_synapse_pairs;
         m_num_synapses = n.m_num_synapses;
         m_time = 0;
@@ -110,10 +268,14 @@ namespace caspian
         max_thresh = n.max_thresh;
         soft_reset = n.soft_reset;
         elements.clear();
+        m_stats.clear();
 
         for(auto const &elm : n.elements)
             add_neuron(*(elm.second));
 
+        // add_neuron appends ids in table order -- keep the original ordering instead
+        m_neuron_ids = n.m_neuron_ids;
+
         // update element synapse pointers
         for(auto &&elm : elements)
         {
@@ -137,6 +299,7 @@ namespace caspian
         elements = std::move(n.elements);
 
         /* copy stats */
+        m_stats = std::move(n.m_stats);
         m_num_synapses = n.m_num_synapses;
         m_max_size = n.m_max_size;
         max_syn_delay = n.max_syn_delay;
@@ -149,6 +312,7 @@ namespace caspian
         n.m_max_size = 0;
         n.m_num_synapses = 0;
         n.m_time = 0;
+        n.m_stats.clear();
     }
 
     Network& Network::operator=(Network &&n) noexcept
@@ -163,6 +327,7 @@ namespace caspian
         elements = std::move(n.elements);
 
         /* copy stats */
+        m_stats = std::move(n.m_stats);
         m_num_synapses = n.m_num_synapses;
         m_max_size = n.m_max_size;
         max_syn_delay = n.max_syn_delay;
@@ -175,6 +340,7 @@ namespace caspian
         n.m_max_size = 0;
         n.m_num_synapses = 0;
         n.m_time = 0;
+        n.m_stats.clear();
 
         return *this;
     }
@@ -189,6 +355,11 @@ namespace caspian
         return m_max_size;
     }
 
+    void Network::set_max_size(size_t size)
+    {
+        m_max_size = size;
+    }
+
     uint64_t Network::get_time() const
     {
         return m_time;
@@ -247,10 +418,12 @@ namespace caspian
         {
             elements.emplace(nid, new Neuron(thresh, nid, leak, delay));
             m_neuron_ids.emplace_back(nid);
+            m_stats.add_neuron(delay);
         }
         else
         {
             Neuron &n = get_neuron(nid);
+            m_stats.change_neuron(n.delay, delay);
             n.threshold = thresh;
             n.leak = leak;
             n.delay = delay;
@@ -270,6 +443,13 @@ namespace caspian
 
         elements.emplace(nn->id, nn);
         m_neuron_ids.emplace_back(nn->id);
+
+        // the copy arrives with its synapses -- incoming ones are counted here
+        m_stats.add_neuron(nn->delay);
+        m_stats.move_fan_in(0, nn->synapses.size());
+        m_stats.move_fan_out(0, nn->outputs.size());
+        for(auto const &syn : nn->synapses)
+            m_stats.add_synapse(syn.second.weight, syn.second.delay);
     }
 
     void Network::add_neuron(nlohmann::json &n)
@@ -319,6 +499,8 @@ namespace caspian
             m_neuron_ids.pop_back();
         }
 
+        m_stats.remove_neuron(0, 0, n.delay);
+
         // delete allocated memory
         delete elements.at(nid);
 
@@ -328,6 +510,82 @@ namespace caspian
         return true;
     }
 
+    size_t Network::remove_neurons(const std::vector<uint32_t> &nids)
+    {
+        // gather the neurons to remove -- a table keeps lookups O(1) for large batches
+        NeuronTable doomed;
+        doomed.reserve(nids.size());
+        for(uint32_t nid : nids)
+        {
+            Neuron *n = get_neuron_ptr(nid);
+            if(n != nullptr) doomed.emplace(nid, n);
+        }
+
+        if(doomed.empty()) return 0;
+
+        auto is_doomed = [&doomed](uint32_t nid) { return doomed.find(nid) != doomed.end(); };
+
+        // detach synapses shared with surviving neurons
+        for(auto const &elm : doomed)
+        {
+            Neuron *n = elm.second;
+
+            // every removed synapse is an output of a removed neuron or an input from a survivor
+            for(auto const &p : n->outputs)
+            {
+                m_stats.remove_synapse(p.second->weight, p.second->delay);
+
+                if(!is_doomed(p.first->id))
+                {
+                    size_t fan_in = p.first->synapses.size();
+                    p.first->synapses.erase(n->id);
+                    m_stats.move_fan_in(fan_in, fan_in - 1);
+                }
+            }
+
+            for(auto const &syn : n->synapses)
+            {
+                if(is_doomed(syn.first)) continue;
+
+                m_stats.remove_synapse(syn.second.weight, syn.second.delay);
+
+                Neuron *pre = get_neuron_ptr(syn.first);
+                for(size_t i = 0; i < pre->outputs.size(); ++i)
+                {
+                    if(pre->outputs[i].first == n)
+                    {
+                        std::swap(pre->outputs[i], pre->outputs.back());
+                        pre->outputs.pop_back();
+                        m_stats.move_fan_out(pre->outputs.size() + 1, pre->outputs.size());
+                        break;
+                    }
+                }
+            }
+        }
+
+        // the removed neurons keep their own synapse lists intact until deleted
+        for(auto const &elm : doomed)
+            m_stats.remove_neuron(elm.second->synapses.size(), elm.second->outputs.size(), elm.second->delay);
+
+        // filter the id lists in a single pass each
+        size_t n_pairs = m_synapse_pairs.size();
+        m_synapse_pairs.erase(std::remove_if(m_synapse_pairs.begin(), m_synapse_pairs.end(),
+                    [&](const std::pair<uint32_t, uint32_t> &p) { return is_doomed(p.first) || is_doomed(p.second); }),
+                m_synapse_pairs.end());
+        m_num_synapses -= n_pairs - m_synapse_pairs.size();
+
+        m_neuron_ids.erase(std::remove_if(m_neuron_ids.begin(), m_neuron_ids.end(), is_doomed), m_neuron_ids.end());
+
+        // delete allocated memory & remove entries from hash table
+        for(auto const &elm : doomed)
+        {
+            elements.erase(elm.first);
+            delete elm.second;
+        }
+
+        return doomed.size();
+    }
+
     Neuron& Network::get_neuron(uint32_t nid) const
     {
         auto it = elements.find(nid);
@@ -416,25 +674,16 @@ namespace caspian
     {
         if(!is_synapse(from, to))
         {
-            // add synapse to post-synaptic neuron
             Neuron &post_n = get_neuron(to);
-            post_n.synapses.emplace(from, Synapse(w, dly));
-
-            // add synapse to pre-synaptic neuron
             Neuron &pre_n = get_neuron(from);
-            Synapse &s = get_synapse(from, to);
-            pre_n.outputs.emplace_back(&post_n, &s);
-
-            // add to list of synapses
-            m_synapse_pairs.emplace_back(std::make_pair(from, to));
-
-            // increment synapse count
-            ++m_num_synapses;
+            insert_synapse(&pre_n, &post_n, w, dly);
         }
         else
         {
             // if the synapse exists, update values
             Synapse &s = get_synapse(from, to);
+            m_stats.remove_synapse(s.weight, s.delay);
+            m_stats.add_synapse(w, dly);
             s.weight = w;
             s.delay = dly;
         }
@@ -443,6 +692,31 @@ namespace caspian
             max_syn_delay = dly;
     }
 
+    Synapse* Network::insert_synapse(Neuron *pre, Neuron *post, int16_t w, uint8_t dly)
+    {
+        m_stats.add_synapse(w, dly);
+        m_stats.move_fan_in(post->synapses.size(), post->synapses.size() + 1);
+        m_stats.move_fan_out(pre->outputs.size(), pre->outputs.size() + 1);
+
+        // add synapse to post-synaptic neuron -- the hint makes sorted construction O(1)
+        auto it = post->synapses.emplace_hint(post->synapses.end(), pre->id, Synapse(w, dly));
+        Synapse *s = &(it->second);
+
+        // add synapse to pre-synaptic neuron
+        pre->outputs.emplace_back(post, s);
+
+        // add to list of synapses
+        m_synapse_pairs.emplace_back(pre->id, post->id);
+
+        // increment synapse count
+        ++m_num_synapses;
+
+        if(dly > max_syn_delay)
+            max_syn_delay = dly;
+
+        return s;
+    }
+
     void Network::add_synapse(nlohmann::json &s)
     {
         uint32_t from, to;
@@ -474,6 +748,10 @@ namespace caspian
         Neuron* t = get_neuron_ptr(to);
         Synapse* s = get_synapse_ptr(from, to);
 
+        m_stats.remove_synapse(s->weight, s->delay);
+        m_stats.move_fan_in(t->synapses.size(), t->synapses.size() - 1);
+        m_stats.move_fan_out(n->outputs.size(), n->outputs.size() - 1);
+
         for(size_t i = 0; i < n->outputs.size(); ++i)
         {
             if(n->outputs[i].first == t && n->outputs[i].second == s)
@@ -501,6 +779,54 @@ namespace caspian
         return true;
     }
 
+    size_t Network::remove_synapses(const std::vector<std::pair<uint32_t, uint32_t>> &pairs)
+    {
+        // (from, to) packed into a single key
+        tsl::robin_map<uint64_t, bool> doomed;
+        doomed.reserve(pairs.size());
+
+        for(auto const &p : pairs)
+        {
+            if(!is_synapse(p.first, p.second)) continue;
+
+            uint64_t key = (uint64_t(p.first) << 32) | p.second;
+            if(!doomed.emplace(key, true).second) continue;
+
+            Neuron *n = get_neuron_ptr(p.first);
+            Neuron *t = get_neuron_ptr(p.second);
+            const Synapse &s = t->synapses.at(p.first);
+
+            m_stats.remove_synapse(s.weight, s.delay);
+            m_stats.move_fan_in(t->synapses.size(), t->synapses.size() - 1);
+            m_stats.move_fan_out(n->outputs.size(), n->outputs.size() - 1);
+
+            for(size_t i = 0; i < n->outputs.size(); ++i)
+            {
+                if(n->outputs[i].first == t)
+                {
+                    std::swap(n->outputs[i], n->outputs.back());
+                    n->outputs.pop_back();
+                    break;
+                }
+            }
+
+            t->synapses.erase(p.first);
+        }
+
+        if(doomed.empty()) return 0;
+
+        // remove synapse pairs from vector in a single pass
+        m_synapse_pairs.erase(std::remove_if(m_synapse_pairs.begin(), m_synapse_pairs.end(),
+                    [&doomed](const std::pair<uint32_t, uint32_t> &p) {
+                        return doomed.find((uint64_t(p.first) << 32) | p.second) != doomed.end();
+                    }),
+                m_synapse_pairs.end());
+
+        m_num_synapses -= doomed.size();
+
+        return doomed.size();
+    }
+
     Synapse& Network::get_synapse(uint32_t from, Neuron &to) const
     {
         return to.synapses.at(from);
@@ -534,11 +860,39 @@ namespace caspian
         }
         else if(metric == "inhibitory_synapse_count")
         {
-            m = negative_synapses();
+            m = m_stats.negative_synapses();
         }
         else if(metric == "excitatory_synapse_count")
         {
-            m = positive_synapses();
+            m = m_stats.positive_synapses();
+        }
+        else if(metric == "max_fan_in")
+        {
+            m = m_stats.max_fan_in();
+        }
+        else if(metric == "max_fan_out")
+        {
+            m = m_stats.max_fan_out();
+        }
+        else if(metric == "mean_fan_in" || metric == "mean_fan_out")
+        {
+            m = elements.empty() ? 0 : double(m_num_synapses) / elements.size();
+        }
+        else if(metric == "max_synapse_delay")
+        {
+            m = m_stats.max_synapse_delay();
+        }
+        else if(metric == "mean_synapse_delay")
+        {
+            m = m_stats.mean_synapse_delay();
+        }
+        else if(metric == "max_axon_delay")
+        {
+            m = m_stats.max_axon_delay();
+        }
+        else if(metric == "mean_axon_delay")
+        {
+            m = m_stats.mean_axon_delay();
         }
         else
         {
@@ -668,6 +1022,359 @@ namespace caspian
         ss << to_json().dump(2) << std::endl;
     }
 
+    std::vector<uint8_t> Network::to_bytes() const
+    {
+        std::vector<uint8_t> buf;
+        to_bytes(buf);
+        return buf;
+    }
+
+    /* Record layout: header/config, neurons sorted by id (delta-coded), i/o maps, and then
+     * the incoming synapses of each neuron in the same order (sorted by pre-synaptic id). The
+     * sorted order allows from_bytes() to build the synapse maps without any searching. */
+    void Network::to_bytes(std::vector<uint8_t> &buf) const
+    {
+        ByteWriter w(buf);
+
+        std::vector<Neuron*> sorted;
+        sorted.reserve(elements.size());
+        for(auto const &elm : elements)
+            sorted.push_back(elm.second);
+
+        std::sort(sorted.begin(), sorted.end(), [](const Neuron *a, const Neuron *b) { return a->id < b->id; });
+
+        // header & configuration
+        w.u8(constants::BINARY_FORMAT_VER);
+        w.uvar(m_max_size);
+        w.uvar(max_thresh);
+        w.u8(soft_reset);
+        w.u8(max_syn_delay);
+        w.u8(max_axon_delay);
+
+        // neurons
+        uint32_t prev = 0;
+        w.uvar(sorted.size());
+        for(const Neuron *n : sorted)
+        {
+            w.uvar(n->id - prev);
+            w.svar(n->threshold);
+            w.svar(n->leak);
+            w.u8(n->delay);
+            prev = n->id;
+        }
+
+        // i/o ids
+        w.uvar(m_inputs.size());
+        for(int32_t nid : m_inputs) w.svar(nid);
+        w.uvar(m_outputs.size());
+        for(int32_t nid : m_outputs) w.svar(nid);
+
+        // synapses grouped by post-synaptic neuron
+        w.uvar(m_num_synapses);
+        for(const Neuron *n : sorted)
+        {
+            uint32_t prev_from = 0;
+            w.uvar(n->synapses.size());
+            for(auto const &syn : n->synapses)
+            {
+                w.uvar(syn.first - prev_from);
+                w.svar(syn.second.weight);
+                w.u8(syn.second.delay);
+                prev_from = syn.first;
+            }
+        }
+    }
+
+    size_t Network::from_bytes(const uint8_t *data, size_t len)
+    {
+        ByteReader r(data, len);
+
+        if(r.u8() != constants::BINARY_FORMAT_VER)
+            throw std::runtime_error("[from_bytes] Unsupported binary network format version");
+
+        // Clear network
+        purge_elements();
+        m_neuron_ids.clear();
+        m_synapse_pairs.clear();
+        m_inputs.clear();
+        m_outputs.clear();
+        m_time = 0;
+        max_syn_delay = 0;
+        max_axon_delay = 0;
+
+        m_max_size = r.uvar();
+        max_thresh = r.uvar_as<uint16_t>();
+        soft_reset = r.u8();
+        uint8_t syn_delay = r.u8();
+        uint8_t axon_delay = r.u8();
+
+        // neurons -- every record takes at least 3 bytes, which bounds the count before
+        // anything is sized from it
+        size_t n_neurons = r.uvar();
+        if(n_neurons > r.remaining() / 3)
+            throw std::runtime_error("[from_bytes] Neuron count exceeds the data");
+
+        std::vector<Neuron*> sorted(n_neurons);
+        elements.reserve(n_neurons);
+        m_neuron_ids.reserve(n_neurons);
+
+        uint32_t nid = 0;
+        for(size_t i = 0; i < n_neurons; i++)
+        {
+            // ids are strictly increasing
+            uint64_t delta = r.uvar();
+            if((i > 0 && delta == 0) || delta > UINT32_MAX - nid)
+                throw std::runtime_error("[from_bytes] Neuron ids are not increasing");
+
+            nid += delta;
+            int16_t thresh = r.svar_as<int16_t>();
+            int8_t leak = r.svar_as<int8_t>();
+            uint8_t delay = r.u8();
+
+            sorted[i] = new Neuron(thresh, nid, leak, delay);
+            elements.emplace(nid, sorted[i]);
+            m_neuron_ids.push_back(nid);
+            m_stats.add_neuron(delay);
+
+            if(delay > max_axon_delay)
+                max_axon_delay = delay;
+        }
+
+        // i/o ids
+        size_t n_inputs = r.uvar();
+        if(n_inputs > r.remaining())
+            throw std::runtime_error("[from_bytes] Input count exceeds the data");
+
+        m_inputs.resize(n_inputs);
+        for(size_t i = 0; i < m_inputs.size(); i++)
+        {
+            m_inputs[i] = r.svar_as<int32_t>();
+            if(m_inputs[i] < 0) continue;
+
+            Neuron *n = get_neuron_ptr(m_inputs[i]);
+            if(n == nullptr)
+                throw std::runtime_error("[from_bytes] Input " + std::to_string(i) + " references a missing neuron");
+            n->input_id = i;
+        }
+
+        size_t n_outputs = r.uvar();
+        if(n_outputs > r.remaining())
+            throw std::runtime_error("[from_bytes] Output count exceeds the data");
+
+        m_outputs.resize(n_outputs);
+        for(size_t i = 0; i < m_outputs.size(); i++)
+        {
+            m_outputs[i] = r.svar_as<int32_t>();
+            if(m_outputs[i] < 0) continue;
+
+            Neuron *n = get_neuron_ptr(m_outputs[i]);
+            if(n == nullptr)
+                throw std::runtime_error("[from_bytes] Output " + std::to_string(i) + " references a missing neuron");
+            n->output_id = i;
+        }
+
+        // synapses -- at least 3 bytes each
+        size_t n_synapses = r.uvar();
+        if(n_synapses > r.remaining() / 3)
+            throw std::runtime_error("[from_bytes] Synapse count exceeds the data");
+
+        m_synapse_pairs.reserve(n_synapses);
+        for(Neuron *post : sorted)
+        {
+            size_t fan_in = r.uvar();
+            uint32_t from = 0;
+
+            for(size_t i = 0; i < fan_in; i++)
+            {
+                // pre-synaptic ids are strictly increasing
+                uint64_t delta = r.uvar();
+                if((i > 0 && delta == 0) || delta > UINT32_MAX - from)
+                    throw std::runtime_error("[from_bytes] Synapse ids are not increasing");
+
+                from += delta;
+                int16_t weight = r.svar_as<int16_t>();
+                uint8_t delay = r.u8();
+
+                Neuron *pre = get_neuron_ptr(from);
+                if(pre == nullptr)
+                    throw std::runtime_error("[from_bytes] Synapse references a missing neuron");
+
+                insert_synapse(pre, post, weight, delay);
+            }
+        }
+
+        // the stored maxima may only widen what the contents need
+        max_syn_delay = std::max(max_syn_delay, syn_delay);
+        max_axon_delay = std::max(max_axon_delay, axon_delay);
+
+        return r.consumed();
+    }
+
+    void Network::from_arrays(size_t n_neurons, const uint32_t *ids, const int16_t *thresholds,
+                              const int8_t *leaks, const uint8_t *delays,
+                              size_t n_synapses, const uint32_t *src, const uint32_t *dst,
+                              const int16_t *weights, const uint8_t *syn_delays,
+                              size_t n_inputs, const int32_t *inputs,
+                              size_t n_outputs, const int32_t *outputs)
+    {
+        // Clear network -- the delay maxima are recomputed from the arrays
+        purge_elements();
+        m_inputs.clear();
+        m_outputs.clear();
+        m_time = 0;
+        max_syn_delay = 0;
+        max_axon_delay = 0;
+
+        elements.reserve(n_neurons);
+        m_neuron_ids.reserve(n_neurons);
+
+        for(size_t i = 0; i < n_neurons; i++)
+        {
+            if(is_neuron(ids[i]))
+            {
+                purge_elements();
+                throw std::invalid_argument("[from_arrays] Duplicate neuron " + std::to_string(ids[i]));
+            }
+
+            elements.emplace(ids[i], new Neuron(thresholds[i], ids[i], leaks[i], delays[i]));
+            m_neuron_ids.push_back(ids[i]);
+            m_stats.add_neuron(delays[i]);
+
+            if(delays[i] > max_axon_delay)
+                max_axon_delay = delays[i];
+        }
+
+        // insertion in (dst, src) order keeps every synapse map insert at the end
+        auto before = [&](size_t a, size_t b) {
+            return (dst[a] != dst[b]) ? (dst[a] < dst[b]) : (src[a] < src[b]);
+        };
+
+        std::vector<uint32_t> order;
+        bool sorted = true;
+        for(size_t i = 1; i < n_synapses && sorted; i++)
+            sorted = !before(i, i-1);
+
+        if(!sorted)
+        {
+            order.resize(n_synapses);
+            for(size_t i = 0; i < n_synapses; i++) order[i] = i;
+            std::stable_sort(order.begin(), order.end(), before);
+        }
+
+        m_synapse_pairs.reserve(n_synapses);
+
+        Neuron *post = nullptr;
+        for(size_t k = 0; k < n_synapses; k++)
+        {
+            size_t i = sorted ? k : order[k];
+
+            // a repeated synapse keeps its last entry, as with add_synapse()
+            if(k + 1 < n_synapses)
+            {
+                size_t j = sorted ? k + 1 : order[k+1];
+                if(src[i] == src[j] && dst[i] == dst[j]) continue;
+            }
+
+            if(post == nullptr || post->id != dst[i])
+                post = get_neuron_ptr(dst[i]);
+
+            Neuron *pre = get_neuron_ptr(src[i]);
+            if(pre == nullptr || post == nullptr)
+            {
+                purge_elements();
+                throw std::invalid_argument("[from_arrays] Synapse " + std::to_string(src[i]) + " -> " +
+                        std::to_string(dst[i]) + " references a missing neuron");
+            }
+
+            insert_synapse(pre, post, weights[i], syn_delays[i]);
+        }
+
+        // i/o ids
+        for(size_t i = 0; i < n_inputs + n_outputs; i++)
+        {
+            int32_t nid = (i < n_inputs) ? inputs[i] : outputs[i - n_inputs];
+            if(nid >= 0 && !is_neuron(nid))
+            {
+                purge_elements();
+                throw std::invalid_argument("[from_arrays] I/O neuron " + std::to_string(nid) + " does not exist");
+            }
+        }
+
+        m_inputs.assign(inputs, inputs + n_inputs);
+        for(size_t i = 0; i < m_inputs.size(); i++)
+            if(m_inputs[i] >= 0) get_neuron(m_inputs[i]).input_id = i;
+
+        m_outputs.assign(outputs, outputs + n_outputs);
+        for(size_t i = 0; i < m_outputs.size(); i++)
+            if(m_outputs[i] >= 0) get_neuron(m_outputs[i]).output_id = i;
+    }
+
+    void Network::from_arrays(const NetworkArrays &a)
+    {
+        if(a.thresholds.size() != a.neuron_ids.size() || a.leaks.size() != a.neuron_ids.size() ||
+           a.delays.size() != a.neuron_ids.size())
+            throw std::invalid_argument("[from_arrays] Neuron arrays must have matching length");
+
+        if(a.dst.size() != a.src.size() || a.weights.size() != a.src.size() || a.syn_delays.size() != a.src.size())
+            throw std::invalid_argument("[from_arrays] Synapse arrays must have matching length");
+
+        from_arrays(a.neuron_ids.size(), a.neuron_ids.data(), a.thresholds.data(), a.leaks.data(), a.delays.data(),
+                    a.src.size(), a.src.data(), a.dst.data(), a.weights.data(), a.syn_delays.data(),
+                    a.inputs.size(), a.inputs.data(), a.outputs.size(), a.outputs.data());
+
+        set_max_size(a.max_size);
+        max_thresh = a.max_thresh;
+        soft_reset = a.soft_reset;
+    }
+
+    NetworkArrays Network::to_arrays() const
+    {
+        NetworkArrays a;
+
+        std::vector<const Neuron*> sorted;
+        sorted.reserve(elements.size());
+        for(auto const &elm : elements)
+            sorted.push_back(elm.second);
+
+        std::sort(sorted.begin(), sorted.end(), [](const Neuron *x, const Neuron *y) { return x->id < y->id; });
+
+        a.neuron_ids.reserve(sorted.size());
+        a.thresholds.reserve(sorted.size());
+        a.leaks.reserve(sorted.size());
+        a.delays.reserve(sorted.size());
+
+        a.src.reserve(m_num_synapses);
+        a.dst.reserve(m_num_synapses);
+        a.weights.reserve(m_num_synapses);
+        a.syn_delays.reserve(m_num_synapses);
+
+        for(const Neuron *n : sorted)
+        {
+            a.neuron_ids.push_back(n->id);
+            a.thresholds.push_back(n->threshold);
+            a.leaks.push_back(n->leak);
+            a.delays.push_back(n->delay);
+
+            // synapse maps are keyed (and so ordered) by the pre-synaptic id
+            for(auto const &syn : n->synapses)
+            {
+                a.src.push_back(syn.first);
+                a.dst.push_back(n->id);
+                a.weights.push_back(syn.second.weight);
+                a.syn_delays.push_back(syn.second.delay);
+            }
+        }
+
+        a.inputs = m_inputs;
+        a.outputs = m_outputs;
+
+        a.max_size = m_max_size;
+        a.max_thresh = max_thresh;
+        a.soft_reset = soft_reset;
+
+        return a;
+    }
+
     std::string Network::to_gml() const
     {
         std::ostringstream oss;
@@ -701,76 +1408,25 @@ namespace caspian
 
     void Network::prune(bool io_prune)
     {
-        // create a list of neurons to remove
-        std::set<uint32_t> remove_list;
-
-        // recursive lambda implementation of DFS
-        std::function<void(Neuron*)> traverse_outputs;
-        traverse_outputs = [&traverse_outputs](Neuron *n) {
-            // use charge variable to indicate visited or not     
-            if(n->charge > 0) return;
-
-            // label as visited
-            n->charge = 1;
-
-            // traverse connections
-            for(auto output : n->outputs)
-                traverse_outputs(output.first);
-        };
-
-        // recursive lambda implementation of DFS
-        std::function<void(Neuron*)> traverse_inputs;
-        traverse_inputs = [&traverse_inputs, this](Neuron *n) {
-            // use charge variable to indicate visited or not     
-            if(n->charge > 0) return;
-
-            // label as visited
-            n->charge = 1;
-
-            // traverse connections
-            for(auto input : n->synapses)
-                traverse_inputs(elements.at(input.first));
-        };
-
-        // initially reset state 
-        reset();
+        // neurons which are reachable from an input and can reach an output
+        NetworkAnalysis analysis(*this);
+        Bitset live = analysis.live();
 
-        // DFS from each input
-        for(auto c : m_inputs)
-            if(is_neuron(c))
-                traverse_outputs(elements.at(c));
-
-        // check each neuron to see if it was visited in the search
-        for(auto elm : elements)
-            if(elm.second->charge == 0 && (io_prune || (elm.second->input_id == -1 && elm.second->output_id == -1)))
-                remove_list.insert(elm.first);
-
-        // remove all the extra neurons
-        for(auto c : remove_list)
-            remove_neuron(c);
-
-        // return the network to a reset state to remove added charge
-        reset();
-
-        // clear the removal set
-        remove_list.clear();
+        // create a list of neurons to remove
+        std::vector<uint32_t> remove_list;
+        const std::vector<uint32_t> &ids = analysis.ids();
 
-        // DFS backwards for each output
-        for(auto c : m_outputs)
-            if(is_neuron(c))
-                traverse_inputs(elements.at(c));
+        for(size_t i = 0; i < ids.size(); i++)
+        {
+            if(live.test(i)) continue;
 
-        // check each neuron to see if it was visited in the search
-        for(auto elm : elements)
-            if(elm.second->charge == 0 && (io_prune || (elm.second->input_id == -1 && elm.second->output_id == -1)))
-                remove_list.insert(elm.first);
+            Neuron *n = get_neuron_ptr(ids[i]);
+            if(io_prune || (n->input_id == -1 && n->output_id == -1))
+                remove_list.push_back(ids[i]);
+        }
 
         // remove all the extra neurons
-        for(auto c : remove_list)
-            remove_neuron(c);
-
-        // return the network to a reset state to remove added charge
-        reset();
+        remove_neurons(remove_list);
     }
 
     NeuronTable::iterator Network::begin()
@@ -810,32 +1466,33 @@ namespace caspian
             delete elm.second;
 
         elements.clear();
+        m_neuron_ids.clear();
+        m_synapse_pairs.clear();
+        m_stats.clear();
 
         m_num_synapses = 0;
     }
 
-    int Network::positive_synapses() const
+    const NetworkStats& Network::get_stats() const
     {
-        int cnt = 0;
-
-        for(auto elm : elements)
-            for(auto syn : elm.second->synapses)
-                if(syn.second.weight > 0)
-                    cnt++;
-
-        return cnt;
+        return m_stats;
     }
 
-    int Network::negative_synapses() const
+    void Network::rebuild_stats()
     {
-        int cnt = 0;
+        m_stats.clear();
 
-        for(auto elm : elements)
-            for(auto syn : elm.second->synapses)
-                if(syn.second.weight < 0)
-                    cnt++;
+        for(auto const &elm : elements)
+        {
+            Neuron *n = elm.second;
 
-        return cnt;
+            m_stats.add_neuron(n->delay);
+            m_stats.move_fan_in(0, n->synapses.size());
+            m_stats.move_fan_out(0, n->outputs.size());
+
+            for(auto const &syn : n->synapses)
+                m_stats.add_synapse(syn.second.weight, syn.second.delay);
+        }
     }
 
     uint32_t Network::get_random_input() const
@@ -922,6 +1579,53 @@ namespace caspian
         return true;
     }
 
+    uint64_t Network::structural_hash() const
+    {
+        // Neurons and synapses are combined with a sum so the result does not depend on
+        // insertion or hash table order. Each element is keyed by its id(s), which are unique,
+        // so identical elements never cancel out.
+        uint64_t h_neurons = 0;
+        uint64_t h_synapses = 0;
+
+        for(uint32_t nid : m_neuron_ids)
+        {
+            const Neuron *n = get_neuron_ptr(nid);
+
+            uint64_t params = (uint64_t(uint16_t(n->threshold)) << 16)
+                            | (uint64_t(uint8_t(n->leak)) << 8)
+                            | uint64_t(n->delay);
+
+            h_neurons += hash_mix(hash_mix(nid) ^ params);
+
+            for(auto const &syn : n->synapses)
+            {
+                uint64_t key = (uint64_t(syn.first) << 32) | nid;
+                uint64_t sparams = (uint64_t(uint16_t(syn.second.weight)) << 8) | syn.second.delay;
+                h_synapses += hash_mix(hash_mix(key) ^ sparams);
+            }
+        }
+
+        uint64_t h = hash_mix(m_neuron_ids.size());
+        h = hash_mix(h ^ h_neurons);
+        h = hash_mix(h ^ uint64_t(m_num_synapses));
+        h = hash_mix(h ^ h_synapses);
+
+        // configuration
+        h = hash_mix(h ^ ((uint64_t(max_thresh) << 24) | (uint64_t(soft_reset) << 16)
+                        | (uint64_t(max_syn_delay) << 8) | max_axon_delay));
+
+        // i/o mapping is ordered
+        h = hash_mix(h ^ m_inputs.size());
+        for(int32_t nid : m_inputs)
+            h = hash_mix(h ^ uint32_t(nid));
+
+        h = hash_mix(h ^ m_outputs.size());
+        for(int32_t nid : m_outputs)
+            h = hash_mix(h ^ uint32_t(nid));
+
+        return h;
+    }
+
     void Network::make_random(int n_inputs, 
             int n_outputs,
             uint64_t seed,
@@ -1035,6 +1739,168 @@ namespace caspian
         }
     }
 
+    void Network::generate_random(const RandomNetworkParams &p, uint64_t seed)
+    {
+        const int n_neurons = m_max_size;
+        const int n_hidden_neurons = n_neurons - p.n_inputs - p.n_outputs;
+        const int start_outputs = p.n_inputs;
+        const int end_outputs = p.n_inputs + p.n_outputs;
+
+        const int n_hidden_synapses_max = (p.n_hidden_synapses_max == -1) ? 
+            p.n_hidden_synapses * 1.2 : p.n_hidden_synapses_max;
+
+        if(n_hidden_neurons < 0)
+            throw std::invalid_argument("[generate_random] Network size is smaller than inputs + outputs");
+
+        if(n_hidden_neurons == 0 && (p.n_input_synapses > 0 || p.n_output_synapses > 0))
+            throw std::invalid_argument("[generate_random] Input/output synapses require hidden neurons");
+
+        for(auto const &r : {p.threshold_range, p.leak_range, p.weight_range, p.delay_range})
+            if(r.first > r.second)
+                throw std::invalid_argument("[generate_random] Invalid range");
+
+        SplitMix64 rng(seed);
+
+        // flush out anything that might already be in this network
+        purge_elements();
+        elements.reserve(n_neurons);
+        m_neuron_ids.reserve(n_neurons);
+
+        std::vector<Neuron*> neurons(n_neurons);
+
+        for(int i = 0; i < n_neurons; ++i)
+        {
+            int threshold = rng.range(p.threshold_range.first, p.threshold_range.second);
+            int leak = rng.range(p.leak_range.first, p.leak_range.second);
+            add_neuron(i, threshold, leak);
+            neurons[i] = elements.at(i);
+        }
+
+        for(int i = 0; i < p.n_inputs; ++i)
+            set_input(i, i);
+
+        for(int i = 0; i < p.n_outputs; ++i)
+            set_output(start_outputs + i, i);
+
+        // Synapses are drawn into a flat edge list and built in one sorted pass at the end.
+        // The key orders by (to, from) so every insert into a neuron's synapse map is at the end.
+        struct Edge
+        {
+            uint64_t key;
+            int16_t weight;
+            uint8_t delay;
+        };
+
+        std::vector<Edge> edges;
+        edges.reserve(p.n_inputs * p.n_input_synapses + p.n_outputs * p.n_output_synapses
+                      + n_hidden_neurons * p.n_hidden_synapses);
+
+        // the hidden fan-in cap counts drawn synapses (repeats included)
+        std::vector<uint32_t> fan_in(n_neurons, 0);
+
+        auto rand_syn = [&](uint32_t fr, uint32_t to)
+        {
+            int sign = (rng.uniform() < p.inhibitory_percentage) ? -1 : 1;
+            int16_t weight = rng.range(p.weight_range.first, p.weight_range.second) * sign;
+            uint8_t delay = rng.range(p.delay_range.first, p.delay_range.second);
+
+            edges.push_back({(uint64_t(to) << 32) | fr, weight, delay});
+            fan_in[to]++;
+        };
+
+        // inputs -> hidden synapses
+        for(int i = 0; i < p.n_inputs; ++i)
+            for(int j = 0; j < p.n_input_synapses; ++j)
+                rand_syn(i, rng.range(end_outputs, n_neurons-1));
+
+        // hidden -> output synapses
+        for(int i = 0; i < p.n_outputs; ++i)
+            for(int j = 0; j < p.n_output_synapses; ++j)
+                rand_syn(rng.range(end_outputs, n_neurons-1), start_outputs+i);
+
+        // hidden -> hidden synapses (needs at least two hidden neurons to avoid self loops)
+        for(int i = 0; i < n_hidden_neurons && n_hidden_neurons > 1; ++i)
+        {
+            uint32_t fr = end_outputs + i;
+
+            for(int j = 0; j < p.n_hidden_synapses; ++j)
+            {
+                uint32_t to;
+                do {
+                    to = rng.range(end_outputs, n_neurons-1);
+                } while(fr == to);
+
+                if(fan_in[to] < uint32_t(n_hidden_synapses_max))
+                    rand_syn(fr, to);
+            }
+        }
+
+        // stable, so a repeated draw overwrites the earlier values (as add_synapse would)
+        std::stable_sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+            return a.key < b.key;
+        });
+
+        m_synapse_pairs.reserve(edges.size());
+
+        for(size_t i = 0; i < edges.size(); i++)
+        {
+            const Edge &e = edges[i];
+            if(i + 1 < edges.size() && edges[i+1].key == e.key) continue;
+            insert_synapse(neurons[uint32_t(e.key)], neurons[e.key >> 32], e.weight, e.delay);
+        }
+    }
+
+    std::vector<Network*> make_random_networks(size_t count, size_t size, uint64_t seed,
+                                               const RandomNetworkParams &params, int num_threads)
+    {
+        std::vector<Network*> nets(count, nullptr);
+
+        if(num_threads <= 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        num_threads = std::min<size_t>(num_threads, std::max<size_t>(count, 1));
+
+        std::atomic<size_t> next(0);
+        std::vector<std::exception_ptr> errors(num_threads);
+
+        auto worker = [&](int tid)
+        {
+            try
+            {
+                size_t i;
+                while((i = next.fetch_add(1)) < count)
+                {
+                    // each network's stream depends only on (seed, i)
+                    nets[i] = new Network(size);
+                    nets[i]->generate_random(params, hash_mix(seed ^ hash_mix(i)));
+                }
+            }
+            catch(...)
+            {
+                errors[tid] = std::current_exception();
+                next = count;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(int t = 1; t < num_threads; t++)
+            threads.emplace_back(worker, t);
+        worker(0);
+
+        for(auto &t : threads)
+            t.join();
+
+        for(auto const &e : errors)
+        {
+            if(e)
+            {
+                for(Network *n : nets) delete n;
+                std::rethrow_exception(e);
+            }
+        }
+
+        return nets;
+    }
+
 }
 
 /* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
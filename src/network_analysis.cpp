@@ -0,0 +1,165 @@
+#include "network_analysis.hpp"
+
+namespace caspian
+{
+    size_t Bitset::count() const
+    {
+        size_t c = 0;
+        for(uint64_t w : m_words)
+            c += __builtin_popcountll(w);
+        return c;
+    }
+
+    Bitset& Bitset::operator&=(const Bitset &rhs)
+    {
+        for(size_t i = 0; i < m_words.size() && i < rhs.m_words.size(); i++)
+            m_words[i] &= rhs.m_words[i];
+        return *this;
+    }
+
+    Bitset& Bitset::operator|=(const Bitset &rhs)
+    {
+        for(size_t i = 0; i < m_words.size() && i < rhs.m_words.size(); i++)
+            m_words[i] |= rhs.m_words[i];
+        return *this;
+    }
+
+    NetworkAnalysis::NetworkAnalysis(const Network &net)
+    {
+        m_ids = net.get_neuron_list();
+
+        const size_t n = m_ids.size();
+        m_index.reserve(n);
+        for(size_t i = 0; i < n; i++)
+            m_index.emplace(m_ids[i], i);
+
+        std::vector<Neuron*> neurons(n);
+        for(size_t i = 0; i < n; i++)
+            neurons[i] = net.get_neuron_ptr(m_ids[i]);
+
+        // outgoing edges
+        m_out_offsets.resize(n + 1, 0);
+        for(size_t i = 0; i < n; i++)
+            m_out_offsets[i+1] = m_out_offsets[i] + neurons[i]->outputs.size();
+
+        m_out_edges.resize(m_out_offsets[n]);
+        for(size_t i = 0; i < n; i++)
+        {
+            uint32_t *e = &m_out_edges[m_out_offsets[i]];
+            for(auto const &p : neurons[i]->outputs)
+                *e++ = m_index.at(p.first->id);
+        }
+
+        // incoming edges (transpose)
+        m_in_offsets.resize(n + 1, 0);
+        for(uint32_t to : m_out_edges)
+            m_in_offsets[to+1]++;
+        for(size_t i = 0; i < n; i++)
+            m_in_offsets[i+1] += m_in_offsets[i];
+
+        m_in_edges.resize(m_out_edges.size());
+        std::vector<uint32_t> fill(m_in_offsets.begin(), m_in_offsets.end() - 1);
+        for(size_t i = 0; i < n; i++)
+            for(uint32_t k = m_out_offsets[i]; k < m_out_offsets[i+1]; k++)
+                m_in_edges[fill[m_out_edges[k]]++] = i;
+
+        // i/o -- ignore unassigned ids and removed neurons
+        for(size_t i = 0; i < net.num_inputs(); i++)
+        {
+            int64_t idx = index_of(net.get_input(i));
+            if(idx >= 0) m_inputs.push_back(idx);
+        }
+
+        for(size_t i = 0; i < net.num_outputs(); i++)
+        {
+            int64_t idx = index_of(net.get_output(i));
+            if(idx >= 0) m_outputs.push_back(idx);
+        }
+    }
+
+    size_t NetworkAnalysis::size() const
+    {
+        return m_ids.size();
+    }
+
+    const std::vector<uint32_t>& NetworkAnalysis::ids() const
+    {
+        return m_ids;
+    }
+
+    int64_t NetworkAnalysis::index_of(uint32_t nid) const
+    {
+        auto it = m_index.find(nid);
+        return (it == m_index.end()) ? -1 : int64_t(it->second);
+    }
+
+    Bitset NetworkAnalysis::traverse(const std::vector<uint32_t> &seeds,
+                                     const std::vector<uint32_t> &offsets,
+                                     const std::vector<uint32_t> &edges) const
+    {
+        Bitset visited(m_ids.size());
+        std::vector<uint32_t> stack;
+        stack.reserve(m_ids.size());
+
+        for(uint32_t s : seeds)
+        {
+            if(visited.test(s)) continue;
+            visited.set(s);
+            stack.push_back(s);
+        }
+
+        // iterative DFS -- an explicit stack keeps deep chains from overflowing
+        while(!stack.empty())
+        {
+            uint32_t cur = stack.back();
+            stack.pop_back();
+
+            for(uint32_t k = offsets[cur]; k < offsets[cur+1]; k++)
+            {
+                uint32_t next = edges[k];
+                if(visited.test(next)) continue;
+                visited.set(next);
+                stack.push_back(next);
+            }
+        }
+
+        return visited;
+    }
+
+    Bitset NetworkAnalysis::reach_forward(const std::vector<uint32_t> &seeds) const
+    {
+        return traverse(seeds, m_out_offsets, m_out_edges);
+    }
+
+    Bitset NetworkAnalysis::reach_backward(const std::vector<uint32_t> &seeds) const
+    {
+        return traverse(seeds, m_in_offsets, m_in_edges);
+    }
+
+    Bitset NetworkAnalysis::forward_reachable() const
+    {
+        return reach_forward(m_inputs);
+    }
+
+    Bitset NetworkAnalysis::backward_reachable() const
+    {
+        return reach_backward(m_outputs);
+    }
+
+    Bitset NetworkAnalysis::live() const
+    {
+        Bitset b = forward_reachable();
+        b &= backward_reachable();
+        return b;
+    }
+
+    std::vector<uint32_t> NetworkAnalysis::to_ids(const Bitset &b) const
+    {
+        std::vector<uint32_t> v;
+        for(size_t i = 0; i < m_ids.size(); i++)
+            if(b.test(i)) v.push_back(m_ids[i]);
+        return v;
+    }
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "framework.hpp"
 #include "network.hpp"
 #include "network_conversion.hpp"
@@ -63,6 +65,51 @@ namespace caspian
     }
 
 
+    static inline uint64_t hash_values(uint64_t h, const std::vector<double> &values)
+    {
+        for(double v : values)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            h = hash_mix(h ^ bits);
+        }
+        return h;
+    }
+
+    uint64_t network_framework_fingerprint(neuro::Network *tn)
+    {
+        if(tn == nullptr)
+            return 0;
+
+        // elements are summed so the iteration order of the framework containers is irrelevant
+        uint64_t h_nodes = 0;
+        uint64_t h_edges = 0;
+        size_t n_nodes = 0;
+        size_t n_edges = 0;
+
+        for(auto nit = tn->begin(); nit != tn->end(); ++nit)
+        {
+            neuro::Node* node = nit->second.get();
+
+            uint64_t h = hash_mix(uint32_t(nit->first));
+            h = hash_mix(h ^ ((uint64_t(uint32_t(node->input_id)) << 32) | uint32_t(node->output_id)));
+            h_nodes += hash_values(h, node->values);
+            n_nodes++;
+        }
+
+        for(auto eit = tn->edges_begin(); eit != tn->edges_end(); ++eit)
+        {
+            uint64_t h = hash_mix((uint64_t(uint32_t(eit->first.first)) << 32) | uint32_t(eit->first.second));
+            h_edges += hash_values(h, eit->second->values);
+            n_edges++;
+        }
+
+        uint64_t h = hash_mix(n_nodes);
+        h = hash_mix(h ^ h_nodes);
+        h = hash_mix(h ^ n_edges);
+        return hash_mix(h ^ h_edges);
+    }
+
     bool internal_network_to_tennlab(caspian::Network* /*net*/, neuro::Network* /*tn*/)
     {
         // TODO
@@ -0,0 +1,301 @@
+#include <algorithm>
+
+#include "network_diff.hpp"
+#include "byte_stream.hpp"
+#include "constants.hpp"
+
+namespace caspian
+{
+    bool NetworkDiff::empty() const
+    {
+        // configuration-only changes show up in the hashes
+        return base_hash == target_hash && removed_neurons.empty() && removed_synapses.empty() &&
+               neurons.empty() && synapses.empty() && !io_changed;
+    }
+
+    std::vector<uint8_t> NetworkDiff::to_bytes() const
+    {
+        std::vector<uint8_t> buf;
+        to_bytes(buf);
+        return buf;
+    }
+
+    void NetworkDiff::to_bytes(std::vector<uint8_t> &buf) const
+    {
+        ByteWriter w(buf);
+
+        // header & configuration
+        w.u8(constants::BINARY_FORMAT_VER);
+        w.u64(base_hash);
+        w.u64(target_hash);
+        w.uvar(max_thresh);
+        w.u8(soft_reset);
+        w.u8(max_syn_delay);
+        w.u8(max_axon_delay);
+
+        // neurons -- entries are sorted by id, so ids are delta encoded
+        uint32_t prev = 0;
+        w.uvar(removed_neurons.size());
+        for(uint32_t nid : removed_neurons)
+        {
+            w.uvar(nid - prev);
+            prev = nid;
+        }
+
+        prev = 0;
+        w.uvar(neurons.size());
+        for(auto const &n : neurons)
+        {
+            w.uvar(n.id - prev);
+            w.svar(n.threshold);
+            w.svar(n.leak);
+            w.u8(n.delay);
+            prev = n.id;
+        }
+
+        // synapses -- sorted by (to, from)
+        prev = 0;
+        w.uvar(removed_synapses.size());
+        for(auto const &p : removed_synapses)
+        {
+            w.uvar(p.second - prev);
+            w.uvar(p.first);
+            prev = p.second;
+        }
+
+        prev = 0;
+        w.uvar(synapses.size());
+        for(auto const &s : synapses)
+        {
+            w.uvar(s.to - prev);
+            w.uvar(s.from);
+            w.svar(s.weight);
+            w.u8(s.delay);
+            prev = s.to;
+        }
+
+        // i/o ids
+        w.u8(io_changed);
+        if(io_changed)
+        {
+            w.uvar(inputs.size());
+            for(int32_t nid : inputs) w.svar(nid);
+            w.uvar(outputs.size());
+            for(int32_t nid : outputs) w.svar(nid);
+        }
+    }
+
+    /* Bounds a count read from r by the data left, given the smallest encoding of an entry */
+    static size_t read_count(ByteReader &r, size_t min_bytes)
+    {
+        size_t n = r.uvar();
+        if(n > r.remaining() / min_bytes)
+            throw std::runtime_error("[NetworkDiff] Entry count exceeds the data");
+        return n;
+    }
+
+    /* Next id of a strictly increasing sequence (or, with allow_equal, non-decreasing) */
+    static uint32_t next_id(ByteReader &r, uint32_t prev, bool first, bool allow_equal = false)
+    {
+        uint64_t delta = r.uvar();
+        if((!first && !allow_equal && delta == 0) || delta > UINT32_MAX - prev)
+            throw std::runtime_error("[NetworkDiff] Entries are not in increasing order");
+        return prev + delta;
+    }
+
+    size_t NetworkDiff::from_bytes(const uint8_t *data, size_t len)
+    {
+        ByteReader r(data, len);
+
+        if(r.u8() != constants::BINARY_FORMAT_VER)
+            throw std::runtime_error("[NetworkDiff] Unsupported binary diff format version");
+
+        *this = NetworkDiff();
+
+        base_hash = r.u64();
+        target_hash = r.u64();
+        max_thresh = r.uvar_as<uint16_t>();
+        soft_reset = r.u8();
+        max_syn_delay = r.u8();
+        max_axon_delay = r.u8();
+
+        // every count is bounded by the data left before anything is sized from it, and
+        // entries must be in the canonical (strictly increasing) order
+        uint32_t prev = 0;
+        removed_neurons.resize(read_count(r, 1));
+        for(size_t i = 0; i < removed_neurons.size(); i++)
+        {
+            prev = next_id(r, prev, i == 0);
+            removed_neurons[i] = prev;
+        }
+
+        prev = 0;
+        neurons.resize(read_count(r, 4));
+        for(size_t i = 0; i < neurons.size(); i++)
+        {
+            auto &n = neurons[i];
+            prev = next_id(r, prev, i == 0);
+            n.id = prev;
+            n.threshold = r.svar_as<int16_t>();
+            n.leak = r.svar_as<int8_t>();
+            n.delay = r.u8();
+        }
+
+        prev = 0;
+        removed_synapses.resize(read_count(r, 2));
+        for(size_t i = 0; i < removed_synapses.size(); i++)
+        {
+            auto &p = removed_synapses[i];
+            prev = next_id(r, prev, i == 0, true);
+            p.second = prev;
+            p.first = r.uvar_as<uint32_t>();
+
+            if(i > 0 && p.second == removed_synapses[i-1].second && p.first <= removed_synapses[i-1].first)
+                throw std::runtime_error("[NetworkDiff] Entries are not in increasing order");
+        }
+
+        prev = 0;
+        synapses.resize(read_count(r, 4));
+        for(size_t i = 0; i < synapses.size(); i++)
+        {
+            auto &s = synapses[i];
+            prev = next_id(r, prev, i == 0, true);
+            s.to = prev;
+            s.from = r.uvar_as<uint32_t>();
+            s.weight = r.svar_as<int16_t>();
+            s.delay = r.u8();
+
+            if(i > 0 && s.to == synapses[i-1].to && s.from <= synapses[i-1].from)
+                throw std::runtime_error("[NetworkDiff] Entries are not in increasing order");
+        }
+
+        io_changed = r.u8();
+        if(io_changed)
+        {
+            inputs.resize(read_count(r, 1));
+            for(auto &nid : inputs) nid = r.svar_as<int32_t>();
+            outputs.resize(read_count(r, 1));
+            for(auto &nid : outputs) nid = r.svar_as<int32_t>();
+        }
+
+        return r.consumed();
+    }
+
+    NetworkDiff Network::diff(const Network &base) const
+    {
+        NetworkDiff d;
+
+        d.base_hash = base.structural_hash();
+        d.target_hash = structural_hash();
+
+        d.max_thresh = max_thresh;
+        d.soft_reset = soft_reset;
+        d.max_syn_delay = max_syn_delay;
+        d.max_axon_delay = max_axon_delay;
+
+        // neurons & their incoming synapses
+        for(uint32_t nid : m_neuron_ids)
+        {
+            const Neuron *n = get_neuron_ptr(nid);
+            const Neuron *b = base.get_neuron_ptr(nid);
+
+            if(b == nullptr || b->threshold != n->threshold || b->leak != n->leak || b->delay != n->delay)
+                d.neurons.push_back({nid, n->threshold, n->leak, n->delay});
+
+            for(auto const &syn : n->synapses)
+            {
+                const Synapse *bs = nullptr;
+                if(b != nullptr)
+                {
+                    auto it = b->synapses.find(syn.first);
+                    if(it != b->synapses.end()) bs = &(it->second);
+                }
+
+                if(bs == nullptr || bs->weight != syn.second.weight || bs->delay != syn.second.delay)
+                    d.synapses.push_back({syn.first, nid, syn.second.weight, syn.second.delay});
+            }
+        }
+
+        // anything only in the base is removed -- synapses of removed neurons are implied
+        for(uint32_t nid : base.m_neuron_ids)
+        {
+            const Neuron *n = get_neuron_ptr(nid);
+
+            if(n == nullptr)
+            {
+                d.removed_neurons.push_back(nid);
+                continue;
+            }
+
+            for(auto const &syn : base.get_neuron_ptr(nid)->synapses)
+            {
+                if(!is_neuron(syn.first)) continue;
+                if(n->synapses.find(syn.first) == n->synapses.end())
+                    d.removed_synapses.emplace_back(syn.first, nid);
+            }
+        }
+
+        if(m_inputs != base.m_inputs || m_outputs != base.m_outputs)
+        {
+            d.io_changed = true;
+            d.inputs = m_inputs;
+            d.outputs = m_outputs;
+        }
+
+        // canonical order for the encoding
+        std::sort(d.removed_neurons.begin(), d.removed_neurons.end());
+        std::sort(d.neurons.begin(), d.neurons.end(),
+                [](const NetworkDiff::NeuronEntry &a, const NetworkDiff::NeuronEntry &b) { return a.id < b.id; });
+        std::sort(d.removed_synapses.begin(), d.removed_synapses.end(),
+                [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+                    return (a.second != b.second) ? (a.second < b.second) : (a.first < b.first);
+                });
+        std::sort(d.synapses.begin(), d.synapses.end(),
+                [](const NetworkDiff::SynapseEntry &a, const NetworkDiff::SynapseEntry &b) {
+                    return (a.to != b.to) ? (a.to < b.to) : (a.from < b.from);
+                });
+
+        return d;
+    }
+
+    void Network::apply_patch(const NetworkDiff &d)
+    {
+        if(structural_hash() != d.base_hash)
+            throw std::runtime_error("[apply_patch] Network does not match the base of the diff");
+
+        remove_synapses(d.removed_synapses);
+        remove_neurons(d.removed_neurons);
+
+        for(auto const &n : d.neurons)
+            add_neuron(n.id, n.threshold, n.leak, n.delay);
+
+        for(auto const &s : d.synapses)
+            add_synapse(s.from, s.to, s.weight, s.delay);
+
+        if(d.io_changed)
+        {
+            for(int32_t nid : m_inputs)
+                if(nid >= 0 && is_neuron(nid)) get_neuron(nid).input_id = -1;
+            for(int32_t nid : m_outputs)
+                if(nid >= 0 && is_neuron(nid)) get_neuron(nid).output_id = -1;
+
+            m_inputs = d.inputs;
+            m_outputs = d.outputs;
+
+            for(size_t i = 0; i < m_inputs.size(); i++)
+                if(m_inputs[i] >= 0 && is_neuron(m_inputs[i])) get_neuron(m_inputs[i]).input_id = i;
+            for(size_t i = 0; i < m_outputs.size(); i++)
+                if(m_outputs[i] >= 0 && is_neuron(m_outputs[i])) get_neuron(m_outputs[i]).output_id = i;
+        }
+
+        max_thresh = d.max_thresh;
+        soft_reset = d.soft_reset;
+        max_syn_delay = d.max_syn_delay;
+        max_axon_delay = d.max_axon_delay;
+
+        if(structural_hash() != d.target_hash)
+            throw std::runtime_error("[apply_patch] Patched network does not match the target of the diff");
+    }
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -0,0 +1,242 @@
+#include <tuple>
+
+#include "optimizer.hpp"
+#include "network_analysis.hpp"
+#include "constants.hpp"
+
+namespace caspian
+{
+    nlohmann::json OptimizerReport::to_json() const
+    {
+        nlohmann::json j;
+
+        j["neurons_before"] = neurons_before;
+        j["synapses_before"] = synapses_before;
+        j["neurons_after"] = neurons_after;
+        j["synapses_after"] = synapses_after;
+
+        j["passes"] = nlohmann::json::array();
+        for(auto const &p : passes)
+        {
+            j["passes"].push_back({
+                {"name", p.name},
+                {"neurons_removed", p.neurons_removed},
+                {"synapses_removed", p.synapses_removed},
+                {"synapses_added", p.synapses_added}
+            });
+        }
+
+        return j;
+    }
+
+    OptimizerPassReport remove_zero_weight_synapses(Network &net)
+    {
+        OptimizerPassReport r;
+        r.name = "zero_weight_synapses";
+
+        // With soft reset, a neuron may hold a supra-threshold charge without being queued
+        // and a zero weight event would trigger a fire. With leak, the extra refresh changes
+        // the rounding of the leak approximation. Only the remaining case is exact.
+        if(net.soft_reset) return r;
+
+        std::vector<std::pair<uint32_t, uint32_t>> remove_list;
+
+        for(auto const &p : net.get_synapse_list())
+        {
+            Neuron *post = net.get_neuron_ptr(p.second);
+            if(post->leak < 0 && post->threshold >= 0 && post->synapses.at(p.first).weight == 0)
+                remove_list.push_back(p);
+        }
+
+        r.synapses_removed = net.remove_synapses(remove_list);
+        return r;
+    }
+
+    OptimizerPassReport remove_silent_neurons(Network &net)
+    {
+        OptimizerPassReport r;
+        r.name = "silent_neurons";
+
+        NetworkAnalysis analysis(net);
+        const std::vector<uint32_t> &ids = analysis.ids();
+        const size_t n = ids.size();
+
+        // a neuron starting at zero charge with a non-negative threshold can only fire
+        // if it receives positive charge from an input or a positive synapse
+        std::vector<Neuron*> neurons(n);
+        std::vector<uint32_t> positive_in(n, 0);
+        Bitset silent(n);
+        std::vector<uint32_t> worklist;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            neurons[i] = net.get_neuron_ptr(ids[i]);
+            for(auto const &syn : neurons[i]->synapses)
+                if(syn.second.weight > 0)
+                    positive_in[i]++;
+        }
+
+        auto eligible = [&](size_t i) {
+            return positive_in[i] == 0 && neurons[i]->input_id < 0 && neurons[i]->threshold >= 0;
+        };
+
+        for(size_t i = 0; i < n; i++)
+        {
+            if(eligible(i))
+            {
+                silent.set(i);
+                worklist.push_back(i);
+            }
+        }
+
+        // silence propagates through the synapses of silent neurons
+        while(!worklist.empty())
+        {
+            size_t cur = worklist.back();
+            worklist.pop_back();
+
+            for(auto const &p : neurons[cur]->outputs)
+            {
+                if(p.second->weight <= 0) continue;
+
+                size_t idx = analysis.index_of(p.first->id);
+                positive_in[idx]--;
+
+                if(!silent.test(idx) && eligible(idx))
+                {
+                    silent.set(idx);
+                    worklist.push_back(idx);
+                }
+            }
+        }
+
+        // outputs stay (without any synapses), everything else silent is removed
+        std::vector<uint32_t> neuron_list;
+        std::vector<std::pair<uint32_t, uint32_t>> synapse_list;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            if(!silent.test(i)) continue;
+
+            if(neurons[i]->output_id < 0)
+            {
+                neuron_list.push_back(ids[i]);
+                continue;
+            }
+
+            for(auto const &p : neurons[i]->outputs)
+                synapse_list.emplace_back(ids[i], p.first->id);
+            for(auto const &syn : neurons[i]->synapses)
+                synapse_list.emplace_back(syn.first, ids[i]);
+        }
+
+        size_t n_synapses = net.num_synapses();
+        net.remove_synapses(synapse_list);
+        r.neurons_removed = net.remove_neurons(neuron_list);
+        r.synapses_removed = n_synapses - net.num_synapses();
+
+        return r;
+    }
+
+    OptimizerPassReport remove_unreachable_neurons(Network &net)
+    {
+        OptimizerPassReport r;
+        r.name = "unreachable_neurons";
+
+        size_t n_neurons = net.num_neurons();
+        size_t n_synapses = net.num_synapses();
+
+        // a neuron which never receives an event never fires
+        net.prune(false);
+
+        r.neurons_removed = n_neurons - net.num_neurons();
+        r.synapses_removed = n_synapses - net.num_synapses();
+
+        return r;
+    }
+
+    OptimizerPassReport fold_relay_chains(Network &net)
+    {
+        OptimizerPassReport r;
+        r.name = "relay_chains";
+
+        // A hidden neuron B whose only input is A -> B with weight above B's threshold fires
+        // exactly one cycle after every event from A arrives (any leftover charge after a
+        // fire is non-negative). A fire of A at time t reaches B -> C at
+        //     t + A.delay + d(A,B) + 1 + B.delay + d(B,C)
+        // so B -> C can be replaced with A -> C using delay d(A,B) + 1 + B.delay + d(B,C).
+        // Folded neurons are removed after each sweep; chains shorten by a hop per sweep.
+        bool changed = true;
+
+        while(changed)
+        {
+            changed = false;
+            std::vector<uint32_t> folded;
+
+            for(uint32_t bid : net.get_neuron_list())
+            {
+                Neuron *b = net.get_neuron_ptr(bid);
+
+                if(b->input_id >= 0 || b->output_id >= 0) continue;
+                if(b->synapses.size() != 1) continue;
+
+                uint32_t aid = b->synapses.begin()->first;
+                const Synapse &sab = b->synapses.begin()->second;
+
+                if(aid == bid || sab.weight <= b->threshold) continue;
+
+                // every output must be foldable
+                std::vector<std::tuple<uint32_t, int16_t, uint8_t>> adds;
+                bool ok = true;
+
+                for(auto const &p : b->outputs)
+                {
+                    int dly = sab.delay + 1 + b->delay + p.second->delay;
+
+                    if(p.first == b || dly > constants::MAX_DELAY || net.is_synapse(aid, p.first->id))
+                    {
+                        ok = false;
+                        break;
+                    }
+
+                    adds.emplace_back(p.first->id, p.second->weight, dly);
+                }
+
+                if(!ok) continue;
+
+                for(auto const &a : adds)
+                    net.add_synapse(aid, std::get<0>(a), std::get<1>(a), std::get<2>(a));
+
+                // B is removed after the sweep -- its targets now have a second input from A,
+                // so they are not folded during this sweep
+                folded.push_back(bid);
+                r.synapses_added += adds.size();
+                r.synapses_removed += adds.size() + 1;
+                changed = true;
+            }
+
+            r.neurons_removed += net.remove_neurons(folded);
+        }
+
+        return r;
+    }
+
+    OptimizerReport optimize_network(Network &net)
+    {
+        OptimizerReport report;
+        report.neurons_before = net.num_neurons();
+        report.synapses_before = net.num_synapses();
+
+        report.passes.push_back(remove_zero_weight_synapses(net));
+        report.passes.push_back(remove_silent_neurons(net));
+        report.passes.push_back(remove_unreachable_neurons(net));
+        report.passes.push_back(fold_relay_chains(net));
+
+        report.neurons_after = net.num_neurons();
+        report.synapses_after = net.num_synapses();
+
+        return report;
+    }
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
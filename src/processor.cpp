@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
 #include "backend.hpp"
 #include "simulator.hpp"
 #include "constants.hpp"
 #include "ucaspian.hpp"
 #include "processor.hpp"
+#include "optimizer.hpp"
 #include "utils/json_helpers.hpp"
 using json = nlohmann::json;
 
@@ -10,6 +16,8 @@ static json specs = {
     { "Backend",            "S" },
     { "Debug",              "B" },
     { "Allow_Lazy",         "B" },
+    { "Optimize",           "B" },
+    { "Network_Cache_Size", "I" },
     { "Verilator",          "J" },
     { "Min_Threshold",      "I" },
     { "Max_Threshold",      "I" },
@@ -40,6 +48,8 @@ namespace caspian
             { "Backend",                "Event_Simulator" },
             { "Debug",                  false },
             { "Allow_Lazy",             false },
+            { "Optimize",               false },
+            { "Network_Cache_Size",     64 },
             { "Verilator",              {{"Trace_File", ""}}},
             { "Leak_Enable",            true },
             { "Min_Leak",               0 },
@@ -156,10 +166,10 @@ namespace caspian
         if(dev != nullptr)
             delete dev;
 
-        for(size_t i = 0; i < internal_nets.size(); i++)
-        {
-            delete internal_nets[i];
-        }
+        release_networks();
+
+        for(CachedNetwork &c : net_cache)
+            delete c.net;
     }
 
     neuro::PropertyPack Processor::get_network_properties() const
@@ -191,82 +201,217 @@ namespace caspian
     bool Processor::load_network(neuro::Network *n, int /* network_id */)
     {
         multi_net_sim = false;
-        api_nets.clear();
-
-        for(size_t i = 0; i < internal_nets.size(); ++i)
-        {
-            delete internal_nets[i];
-        }
-        internal_nets.clear();
 
         // keep the pointer
-        api_nets.push_back(n);
+        vector<neuro::Network*> nets = { n };
 
-        // make a new shadow network
-        Network *internal_net = new Network();
+        // convert to internal representation (or reuse a cached one) & handle the error case
+        if(!convert_networks(nets))
+            return false;
 
-        // convert to internal representation & handle the error case
-        if(!network_framework_to_internal(n, internal_net))
-        {
-            // get rid of internal represntation for bad network
-            delete internal_net;
-            internal_net = nullptr;
+        // configure the device
+        return dev->configure(internal_nets[0]);
+    }
 
-            // save error message
-            //throw std::runtime_error("Error converting given network to internal representation");
+    bool Processor::load_networks(vector<neuro::Network*> &n)
+    {
+        // Enable multi-network batch mode
+        multi_net_sim = true;
 
-            // return failure
+        if(!convert_networks(n))
             return false;
+
+        return dev->configure_multi(internal_nets);
+    }
+
+    /* Runs fn(i) for i in [0, count) on up to hardware_concurrency threads */
+    template <typename F>
+    static void parallel_for(size_t count, F fn)
+    {
+        size_t n_threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+
+        if(n_threads <= 1)
+        {
+            for(size_t i = 0; i < count; i++) fn(i);
+            return;
         }
 
-        internal_nets.push_back(internal_net);
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            size_t i;
+            while((i = next.fetch_add(1)) < count) fn(i);
+        };
 
-        // configure the device
-        return dev->configure(internal_net);
+        vector<std::thread> threads;
+        for(size_t t = 1; t < n_threads; t++)
+            threads.emplace_back(worker);
+        worker();
+
+        for(auto &t : threads)
+            t.join();
     }
 
-    bool Processor::load_networks(vector<neuro::Network*> &n)
+    void Processor::release_networks()
     {
-        bool convert_error = false;
+        for(CachedNetwork &c : owned_nets)
+            delete c.net;
 
-        // Enable multi-network batch mode
-        multi_net_sim = true;
-        api_nets = n;
+        owned_nets.clear();
+        internal_nets.clear();
+        readouts.clear();
+        opt_reports.clear();
+        api_nets.clear();
+    }
+
+    /* Framework node ids in sorted order and the matching internal neurons */
+    static void build_neuron_index(neuro::Network *api, caspian::Network *net, NeuronIndex &idx)
+    {
+        idx.ids.clear();
+        for(auto nit = api->begin(); nit != api->end(); ++nit)
+            idx.ids.push_back(nit->first);
 
-        // clear old networks
-        for(size_t i = 0; i < internal_nets.size(); ++i)
+        std::sort(idx.ids.begin(), idx.ids.end());
+
+        idx.neurons.resize(idx.ids.size());
+        for(size_t i = 0; i < idx.ids.size(); i++)
+            idx.neurons[i] = net->get_neuron_ptr(idx.ids[i]);
+
+        // a dense table unless the ids are very sparse (lookups then use a binary search)
+        idx.table.clear();
+        if(!idx.ids.empty() && idx.ids.back() < 4 * idx.ids.size() + 1024)
         {
-            delete internal_nets[i];
+            idx.table.resize(idx.ids.back() + 1, -1);
+            for(size_t i = 0; i < idx.ids.size(); i++)
+                idx.table[idx.ids[i]] = i;
         }
-        internal_nets.clear();
+    }
+
+    bool Processor::convert_networks(vector<neuro::Network*> &nets)
+    {
+        const size_t cache_size = std::max(0, jconfig["Network_Cache_Size"].get<int>());
+        const bool optimize = jconfig["Optimize"].get<bool>();
+        const size_t count = nets.size();
 
-        // convert networks
-        for(size_t i = 0; i < api_nets.size(); ++i)
+        release_networks();
+
+        // the fingerprint walk is read-only and far cheaper than a conversion
+        vector<uint64_t> fingerprints(count);
+        parallel_for(count, [&](size_t i) { fingerprints[i] = network_framework_fingerprint(nets[i]); });
+
+        // look up each network; a network listed twice only uses the cached copy once
+        vector<CachedNetwork*> loaded(count, nullptr);
+        vector<CachedNetwork*> misses;
+        std::list<CachedNetwork> fresh;
+
+        for(size_t i = 0; i < count; i++)
         {
-            Network *internal_net = new Network();
+            auto it = std::find_if(net_cache.begin(), net_cache.end(), [&](const CachedNetwork &c) {
+                return c.api == nets[i] && c.fingerprint == fingerprints[i];
+            });
 
-            if(!network_framework_to_internal(api_nets[i], internal_net))
+            if(it != net_cache.end() && !it->in_use)
+            {
+                it->in_use = true;
+                loaded[i] = &(*it);
+                net_cache.splice(net_cache.begin(), net_cache, it);
+            }
+            else
             {
-                delete internal_net;
-                convert_error = true;
-                break;
+                fresh.emplace_back();
+                fresh.back().api = nets[i];
+                fresh.back().fingerprint = fingerprints[i];
+                loaded[i] = &fresh.back();
+                misses.push_back(&fresh.back());
             }
+        }
+
+        // convert (and optimize) the misses in parallel
+        vector<char> ok(misses.size(), true);
+        vector<std::exception_ptr> errors(misses.size());
+        parallel_for(misses.size(), [&](size_t k) {
+            CachedNetwork &c = *misses[k];
+            c.net = new Network();
+
+            try
+            {
+                if(!network_framework_to_internal(c.api, c.net))
+                {
+                    ok[k] = false;
+                    return;
+                }
+
+                if(optimize)
+                    c.report = optimize_network(*c.net);
+
+                build_neuron_index(c.api, c.net, c.index);
+            }
+            catch(...)
+            {
+                // rethrown on the calling thread once everything is cleaned up
+                ok[k] = false;
+                errors[k] = std::current_exception();
+            }
+        });
 
-            internal_nets.push_back(internal_net);
+        bool convert_error = std::find(ok.begin(), ok.end(), false) != ok.end();
+
+        // new conversions go in the cache unless they are duplicates within this load
+        // (splicing keeps the entries, and the pointers to them, in place)
+        while(!fresh.empty())
+        {
+            CachedNetwork &c = fresh.front();
+            c.in_use = true;
+
+            if(convert_error || cache_size == 0 || std::any_of(net_cache.begin(), net_cache.end(),
+                        [&](const CachedNetwork &e) { return e.api == c.api && e.fingerprint == c.fingerprint; }))
+                owned_nets.splice(owned_nets.end(), fresh, fresh.begin());
+            else
+                net_cache.splice(net_cache.begin(), fresh, fresh.begin());
         }
 
+        // evict the least recently used networks which are not part of this load
+        auto it = net_cache.end();
+        while(net_cache.size() > cache_size && it != net_cache.begin())
+        {
+            --it;
+            if(it->in_use) continue;
+            delete it->net;
+            it = net_cache.erase(it);
+        }
+
+        for(CachedNetwork &c : net_cache)
+            c.in_use = false;
+
         if(convert_error)
         {
-            for(size_t i = 0; i < internal_nets.size(); ++i)
-            {
-                delete internal_nets[i];
-            }
-            internal_nets.clear();
-            api_nets.clear();
+            dev->configure(nullptr);
+            release_networks();
+
+            for(auto const &e : errors)
+                if(e) std::rethrow_exception(e);
+
             return false;
         }
 
-        return dev->configure_multi(internal_nets);
+        api_nets = nets;
+        for(size_t i = 0; i < count; i++)
+        {
+            // cached networks carry the activity of their last run
+            loaded[i]->net->reset();
+            internal_nets.push_back(loaded[i]->net);
+            readouts.push_back(&(loaded[i]->index));
+            if(optimize) opt_reports.push_back(loaded[i]->report);
+        }
+
+        return true;
+    }
+
+    json Processor::get_optimizer_report(int network_id) const
+    {
+        if(network_id < 0 || network_id >= int(opt_reports.size()))
+            return json::object();
+
+        return opt_reports[network_id].to_json();
     }
 
     void Processor::apply_spike(const Spike& s,
@@ -276,46 +421,64 @@ namespace caspian
         if(network_id > int(internal_nets.size())-1)
             throw std::runtime_error("[apply] Specified network " + std::to_string(network_id) + " is not loaded");
 
-        int16_t int_val;
-
-        if (normalized) {
-            int_val = s.value * caspian::constants::MAX_DEVICE_INPUT;
-        } else {
-            int_val = s.value;
-            if (int_val < 0 || int_val > caspian::constants::MAX_DEVICE_INPUT)
-                throw std::runtime_error("[apply] Bad spike value: " + std::to_string(s.value) + ": integer part must be >= 0 and <= " 
-                    + std::to_string(caspian::constants::MAX_DEVICE_INPUT));
-        }
-
-        dev->apply_input(s.id, int_val, s.time);
+        dev->apply_input(s.id, spike_value(s, normalized), s.time);
     }
 
     void Processor::apply_spike(const Spike& s,
                                 const vector<int>& network_ids,
                                 bool normalized)
     {
-        (void) s;
-        (void) network_ids;
-        (void) normalized;
-        throw std::invalid_argument("Batch spike is not supported");
+        check_network_ids(network_ids, "apply");
+
+        int16_t int_val = spike_value(s, normalized);
+
+        // each network of a batch gets its own copy of the input
+        for(int network_id : network_ids)
+            dev->apply_input(s.id, int_val, s.time, network_id);
     }
 
     void Processor::apply_spikes(const vector<Spike>& spikes,
                                  bool normalized,
                                  int network_id)
     {
-        // Error check? Not currently needed
-        for(const Spike &s : spikes)
-            apply_spike(s, normalized, network_id);
+        apply_spikes(spikes.data(), spikes.size(), normalized, network_id);
+    }
+
+    void Processor::apply_spikes(const Spike *spikes,
+                                 size_t count,
+                                 bool normalized,
+                                 int network_id)
+    {
+        if(network_id > int(internal_nets.size())-1)
+            throw std::runtime_error("[apply] Specified network " + std::to_string(network_id) + " is not loaded");
+
+        stage_spikes(spikes, count, normalized);
+        dev->apply_inputs(staged_ids.data(), staged_weights.data(), staged_times.data(), count);
     }
 
     void Processor::apply_spikes(const vector<Spike>& spikes,
                                 const vector<int>& network_ids,
                                 bool normalized)
     {
-        // Error check? Not currently needed
-        for(const Spike &s : spikes)
-            apply_spike(s, network_ids, normalized);
+        check_network_ids(network_ids, "apply");
+
+        stage_spikes(spikes.data(), spikes.size(), normalized);
+        for(int network_id : network_ids)
+            dev->apply_inputs(staged_ids.data(), staged_weights.data(), staged_times.data(), spikes.size(), network_id);
+    }
+
+    void Processor::stage_spikes(const Spike *spikes, size_t count, bool normalized)
+    {
+        staged_ids.resize(count);
+        staged_weights.resize(count);
+        staged_times.resize(count);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            staged_ids[i] = spikes[i].id;
+            staged_weights[i] = spike_value(spikes[i], normalized);
+            staged_times[i] = spikes[i].time;
+        }
     }
 
     void Processor::run(double duration, int network_id)
@@ -328,9 +491,35 @@ namespace caspian
 
     void Processor::run(double duration, const vector<int>& network_ids)
     {
-        (void) duration;
-        (void) network_ids;
-        throw std::invalid_argument("Batch run is not supported");
+        check_network_ids(network_ids, "run");
+
+        // the networks of a batch share a single clock, so one pass advances all of them
+        dev->simulate(duration);
+    }
+
+    int16_t Processor::spike_value(const Spike& s, bool normalized) const
+    {
+        int16_t int_val;
+
+        if (normalized) {
+            int_val = s.value * caspian::constants::MAX_DEVICE_INPUT;
+        } else {
+            int_val = s.value;
+            if (int_val < 0 || int_val > caspian::constants::MAX_DEVICE_INPUT)
+                throw std::runtime_error("[apply] Bad spike value: " + std::to_string(s.value) + ": integer part must be >= 0 and <= " 
+                    + std::to_string(caspian::constants::MAX_DEVICE_INPUT));
+        }
+
+        return int_val;
+    }
+
+    void Processor::check_network_ids(const vector<int>& network_ids, const string &caller) const
+    {
+        for(int network_id : network_ids)
+        {
+            if(network_id < 0 || network_id > int(internal_nets.size())-1)
+                throw std::runtime_error("[" + caller + "] Specified network " + std::to_string(network_id) + " is not loaded");
+        }
     }
 
     double Processor::get_time(int network_id)
@@ -444,103 +633,129 @@ namespace caspian
         return ret;
     }
 
-    // NOTE: Added by Katie
-    vector <int> Processor::neuron_counts(int network_id) {
-        if(network_id > int(internal_nets.size())-1)
+    size_t Processor::num_readout_neurons(int network_id) const
+    {
+        if(network_id < 0 || network_id > int(internal_nets.size())-1)
             throw std::runtime_error("[output] Specified network " + std::to_string(network_id) + "is not loaded"); 
-        auto sp_cnts = dev->get_all_spike_cnts();
-        std::map <int, int> id_to_index;
-        int i;
-        std::vector<int> cnts;
-        api_nets[network_id]->make_sorted_node_vector();
-        auto snv = api_nets[network_id]->sorted_node_vector;
-        cnts.resize(snv.size(), 0);
-        for (i = 0; i < (int)snv.size(); i++) {
-            id_to_index[snv[i]->id] = i;
+
+        return readouts[network_id]->ids.size();
+    }
+
+    void Processor::read_neuron_activity(int *counts, double *last_fires, double *charges, int network_id)
+    {
+        const size_t n = num_readout_neurons(network_id);
+        const NeuronIndex &idx = *readouts[network_id];
+
+        if(counts != nullptr) std::fill(counts, counts + n, 0);
+        if(last_fires != nullptr) std::fill(last_fires, last_fires + n, -1);
+
+        // neurons removed by the optimizer never fire and hold no charge
+        if(charges != nullptr)
+            for(size_t i = 0; i < n; i++)
+                charges[i] = (idx.neurons[i] != nullptr) ? idx.neurons[i]->charge : 0;
+
+        if(counts == nullptr && last_fires == nullptr)
+            return;
+
+        // a single pass over the recorded spikes of the last run
+        const SpikeBuffer &sb = dev->get_spike_buffer();
+        const bool batch = !sb.nets.empty();
+
+        for(size_t t = 0; t < sb.cycles(); t++)
+        {
+            for(size_t k = sb.offsets[t]; k < sb.end(t); k++)
+            {
+                if(batch && sb.nets[k] != uint32_t(network_id)) continue;
+
+                int32_t pos = idx.position(sb.ids[k]);
+                if(pos < 0) continue;
+
+                if(counts != nullptr) counts[pos]++;
+                if(last_fires != nullptr) last_fires[pos] = t;
+            }
         }
-        for(auto const &s : sp_cnts)
+    }
+
+    void Processor::read_neuron_bins(int *counts, size_t num_bins, uint64_t duration, int network_id)
+    {
+        if(num_bins == 0 || duration == 0)
+            throw std::invalid_argument("[read_neuron_bins] num_bins and duration must be positive");
+
+        const size_t n = num_readout_neurons(network_id);
+        const NeuronIndex &idx = *readouts[network_id];
+        std::fill(counts, counts + n * num_bins, 0);
+
+        const SpikeBuffer &sb = dev->get_spike_buffer();
+        const bool batch = !sb.nets.empty();
+
+        for(size_t t = 0; t < sb.cycles(); t++)
         {
-            cnts[id_to_index[s.first]] = s.second;
+            const size_t bin = std::min<size_t>(num_bins - 1, t * num_bins / duration);
+
+            for(size_t k = sb.offsets[t]; k < sb.end(t); k++)
+            {
+                if(batch && sb.nets[k] != uint32_t(network_id)) continue;
+
+                int32_t pos = idx.position(sb.ids[k]);
+                if(pos >= 0) counts[pos * num_bins + bin]++;
+            }
         }
+    }
 
+    // NOTE: Added by Katie
+    vector <int> Processor::neuron_counts(int network_id) {
+        vector <int> cnts(num_readout_neurons(network_id));
+        read_neuron_activity(cnts.data(), nullptr, nullptr, network_id);
         return cnts;
     }
 
     // NOTE: Added by Katie
     vector <double> Processor::neuron_last_fires(int network_id) {
-        int i,j;
-        std::vector <std::vector<uint32_t> > all_spikes;
-        std::vector <double> last_times;
-        api_nets[network_id]->make_sorted_node_vector();
-        auto snv = api_nets[network_id]->sorted_node_vector;
-
-        if(network_id > int(internal_nets.size())-1)
-            throw std::runtime_error("[output] Specified network " + std::to_string(network_id) + "is not loaded"); 
-        all_spikes = dev->get_all_spikes();
-        last_times.resize(snv.size(), -1);
-        for (i = 0; i < (int)all_spikes.size(); i++) {
-            for (j = 0; j < (int)all_spikes[i].size(); j++) {
-                last_times[all_spikes[i][j]] = i;
-            }
-        }
+        vector <double> last_times(num_readout_neurons(network_id));
+        read_neuron_activity(nullptr, last_times.data(), nullptr, network_id);
         return last_times;
     }
 
     // NOTE: Added by Katie
     vector <vector <double> > Processor::neuron_vectors(int network_id) {
-        std::vector <std::vector<uint32_t> > all_spikes;
-        std::vector <std::vector<double> > ret_all_spikes;
-        int i, j;
-        api_nets[network_id]->make_sorted_node_vector();
-        auto snv = api_nets[network_id]->sorted_node_vector;
+        vector <vector <double> > ret_all_spikes(num_readout_neurons(network_id));
+        const NeuronIndex &idx = *readouts[network_id];
+        const SpikeBuffer &sb = dev->get_spike_buffer();
+        const bool batch = !sb.nets.empty();
 
-        if(network_id > int(internal_nets.size())-1)
-            throw std::runtime_error("[output] Specified network " + std::to_string(network_id) + "is not loaded"); 
-        all_spikes = dev->get_all_spikes();
-        ret_all_spikes.resize(snv.size());
-        for (i = 0; i < (int)all_spikes.size(); i++) {
-            for (j = 0; j < (int)all_spikes[i].size(); j++) {
-                ret_all_spikes[all_spikes[i][j]].push_back(i);
+        for(size_t t = 0; t < sb.cycles(); t++)
+        {
+            for(size_t k = sb.offsets[t]; k < sb.end(t); k++)
+            {
+                if(batch && sb.nets[k] != uint32_t(network_id)) continue;
+
+                int32_t pos = idx.position(sb.ids[k]);
+                if(pos >= 0) ret_all_spikes[pos].push_back(t);
             }
         }
+
         return ret_all_spikes;
     }
 
     // NOTE: Added by JSP
     vector < double > Processor::neuron_charges(int network_id) {
-        std::vector <double > rv;
-        size_t i;
-        Neuron *n;
-        api_nets[network_id]->make_sorted_node_vector();
-        auto snv = api_nets[network_id]->sorted_node_vector;
-
-        if(network_id > int(internal_nets.size())-1)
-            throw std::runtime_error("[output] Specified network " + std::to_string(network_id) + "is not loaded"); 
-        for (i = 0; i < snv.size(); i++) {
-          n = internal_nets[network_id]->get_neuron_ptr(snv[i]->id);
-          if (n == NULL) {
-            fprintf(stderr, "Internal caspian error.  Couldn't get neuron with id: %u\n",
-               snv[i]->id);
-            exit(1);
-          }
-          rv.push_back(n->charge);
-        }
+        vector <double> rv(num_readout_neurons(network_id));
+        read_neuron_activity(nullptr, nullptr, rv.data(), network_id);
         return rv;
-
     }
 
-    // NOTE: Added by Aaron to match API. Currently not implemented.
+    // NOTE: Added by Aaron to match API. Fires of the network during the last run.
     long long Processor::total_neuron_counts(int network_id) {
-        if(network_id > int(internal_nets.size())-1)
+        if(network_id < 0 || network_id > int(internal_nets.size())-1)
             throw std::runtime_error("[output] Specified network " + std::to_string(network_id) + "is not loaded"); 
-        return -1;
+        return dev->get_network_metric("fire_count", network_id);
     }
 
-    // NOTE: Added by Aaron to match API. Currently not implemented.
+    // NOTE: Added by Aaron to match API. Accumulates of the network during the last run.
     long long Processor::total_neuron_accumulates(int network_id) {
-        if(network_id > int(internal_nets.size())-1)
+        if(network_id < 0 || network_id > int(internal_nets.size())-1)
             throw std::runtime_error("[output] Specified network " + std::to_string(network_id) + "is not loaded"); 
-        return -1;
+        return dev->get_network_metric("accumulate_count", network_id);
     }
 
     /* Removes the network */
@@ -550,15 +765,8 @@ namespace caspian
         if(network_id > int(internal_nets.size())-1)
             throw std::runtime_error("[clear] Specified network " + std::to_string(network_id) + " is not loaded");
 
-        api_nets.clear();
-
-        for(size_t i = 0; i < internal_nets.size(); i++)
-        {
-            delete internal_nets[i];
-        }
-        internal_nets.clear();
-
         dev->configure(nullptr);
+        release_networks();
         multi_net_sim = false;
     }
 
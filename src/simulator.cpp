@@ -54,30 +54,40 @@ namespace caspian
 
     void Simulator::process_fire(const InputFireEvent &e)
     {
-        for(Network *n : nets)
+        // routed inputs only go to their own network
+        if(e.net >= 0)
         {
-            Neuron &to = n->get_neuron(n->get_input(e.id));
+            process_input(nets[e.net], e);
+            return;
+        }
 
-            // refresh the state of the neuron
-            if(to.last_event != net_time)
-                refresh_neuron(&to);
+        for(Network *n : nets)
+            process_input(n, e);
+    }
 
-            // accumulate charge
-            to.charge += e.weight;
+    void Simulator::process_input(Network *n, const InputFireEvent &e)
+    {
+        Neuron &to = n->get_neuron(n->get_input(e.id));
 
-            if(m_debug)
-                printf("[t=%3llu] Neuron %2d charge: %4d after accumulating %4d\n",net_time, to.id, to.charge, e.weight);
+        // refresh the state of the neuron
+        if(to.last_event != net_time)
+            refresh_neuron(&to);
 
-            // increment accumulations count
-            metric_accumulates++;
+        // accumulate charge
+        to.charge += e.weight;
 
-            // check threshold
-            if(to.charge > to.threshold && !to.tcheck)
-            {
-                // add to list of elements to check
-                thresh_check.emplace_back(&to);
-                to.tcheck = true;
-            }
+        if(m_debug)
+            printf("[t=%3llu] Neuron %2d charge: %4d after accumulating %4d\n",net_time, to.id, to.charge, e.weight);
+
+        // increment accumulations count
+        activity[to.tag].accumulates++;
+
+        // check threshold
+        if(to.charge > to.threshold && !to.tcheck)
+        {
+            // add to list of elements to check
+            thresh_check.emplace_back(&to);
+            to.tcheck = true;
         }
     }
 
@@ -93,7 +103,7 @@ namespace caspian
             printf("[t=%3llu] Neuron %2d charge: %4d after accumulating %4d\n",net_time, e.neuron->id, e.neuron->charge, e.syn->weight);
 
         // increment accumulations count
-        metric_accumulates++;
+        activity[e.neuron->tag].accumulates++;
 
         // set synapse last fired
         //e.syn->last_fire = net_time;
@@ -115,7 +125,7 @@ namespace caspian
         if(n->charge > n->threshold)
         {
             // increment count of fires
-            metric_fires++;
+            activity[n->tag].fires++;
 
             if(m_debug)
                 printf("[t=%4llu] > FIRE %3d charge: %6d",net_time, n->id, n->charge);
@@ -123,8 +133,8 @@ namespace caspian
             // optionally, collect every spike
             if(collect_all) 
             {
-                all_spikes.back().push_back(n->id);
-                all_spike_cnts[n->id]++;
+                all_spikes.ids.push_back(n->id);
+                if(multi_net_sim) all_spikes.nets.push_back(n->tag);
             }
 
             // reset charge after firing (soft reset => charge - threshold, hard reset => 0)
@@ -173,8 +183,8 @@ namespace caspian
 
     void Simulator::do_cycle()
     {
-        // add next list to all_spikes; might be empty if there are no fires
-        all_spikes.push_back({});
+        // start the next cycle of all_spikes; might be empty if there are no fires
+        all_spikes.offsets.push_back(all_spikes.ids.size());
 
         // check thresholds after all fires are processed for the timestep
         for(size_t i = 0; i < thresh_check.size(); ++i)
@@ -218,16 +228,25 @@ namespace caspian
         monitor_precise.clear();
         output_logs.clear();
         all_spikes.clear();
-        all_spike_cnts.clear();
 
         // clear internal fires
         for(auto &&f : fires)
             f.clear();
 
+        // keep the unread totals of the previous configuration for get_metric
+        ActivityCounters total = total_activity();
+        metric_unread.fires += total.fires - metric_read.fires;
+        metric_unread.accumulates += total.accumulates - metric_read.accumulates;
+        metric_read = ActivityCounters();
+
+        activity.assign(1, ActivityCounters());
+        run_start_activity.assign(1, ActivityCounters());
+
         // assign the network pointer
         net = n;
         nets.clear();
         nets.push_back(n);
+        multi_net_sim = false;
 
         // extract meaningful configuration if network is not null
         if(n != nullptr)
@@ -240,6 +259,10 @@ namespace caspian
             // neuron soft reset
             soft_reset = net->soft_reset;
 
+            // all activity is counted for the first network
+            for(auto &&elm : net->elements)
+                elm.second->tag = 0;
+
             // set up input mapping
             input_map.resize(net->num_inputs());
             for(size_t i = 0; i < net->num_inputs(); i++)
@@ -255,11 +278,24 @@ namespace caspian
             max_delay = constants::next_pow_of_2(total_max_delay+1)-1;
             dly_mask = max_delay;
             fires.resize(max_delay+1);
+
+            // one neuron firing schedules up to max fan-out events into a single slot
+            reserve_buckets(net->get_stats().max_fan_out(), net->num_neurons());
         }
 
         return true;
     }
 
+    void Simulator::reserve_buckets(size_t fan_out, size_t neurons)
+    {
+        for(auto &f : fires)
+            if(f.capacity() < fan_out)
+                f.reserve(fan_out);
+
+        if(thresh_check.capacity() < neurons)
+            thresh_check.reserve(neurons);
+    }
+
     bool Simulator::configure_multi(std::vector<Network*>& networks)
     {
         // if we can't configure the first... there are problems
@@ -280,13 +316,24 @@ namespace caspian
             if(n->num_inputs() != net->num_inputs()) return false;
             if(n->num_outputs() != net->num_outputs()) return false;
 
-            // assign a tag to the outputs for each network to correspond with internal network id
-            for(int outp = 0; outp < int(n->num_outputs()); outp++)
-                n->get_neuron(n->get_output(outp)).tag = tag;
+            // assign a tag to each neuron to correspond with internal network id
+            for(auto &&elm : n->elements)
+                elm.second->tag = tag;
 
             tag++;
         }
 
+        size_t fan_out = 0, neurons = 0;
+        for(Network *n : nets)
+        {
+            fan_out += n->get_stats().max_fan_out();
+            neurons += n->num_neurons();
+        }
+        reserve_buckets(fan_out, neurons);
+
+        activity.resize(nets.size());
+        run_start_activity.resize(nets.size());
+
         while(output_logs.size() < nets.size())
         {
             output_logs.emplace_back(net->num_outputs());
@@ -301,6 +348,26 @@ namespace caspian
         input_fires.emplace_back(input_id, w, net_time + t);
     }
 
+    void Simulator::apply_input(int input_id, int16_t w, uint64_t t, int network_id)
+    {
+        if(network_id < 0 || network_id >= int(nets.size()))
+            throw std::out_of_range("[apply_input] network index is greater than the loaded networks");
+
+        input_fires.emplace_back(input_id, w, net_time + t, network_id);
+    }
+
+    void Simulator::apply_inputs(const int *input_ids, const int16_t *w, const uint64_t *t,
+                                 size_t count, int network_id)
+    {
+        if(network_id < -1 || network_id >= int(nets.size()))
+            throw std::out_of_range("[apply_inputs] network index is greater than the loaded networks");
+
+        input_fires.reserve(input_fires.size() + count);
+
+        for(size_t i = 0; i < count; i++)
+            input_fires.emplace_back(input_ids[i], w[i], net_time + t[i], network_id);
+    }
+
     bool Simulator::simulate(uint64_t steps)
     {
         uint64_t end_time;
@@ -315,11 +382,12 @@ namespace caspian
         // clear fire tracking information
         for(auto &m : output_logs) m.clear();
 
+        run_start_activity = activity;
+
         run_start_time = net->get_time();
         end_time = run_start_time + steps;
 
         all_spikes.clear();
-        all_spike_cnts.clear();
 
         // ok, not a strictly event-based system for now
         for(net_time = run_start_time; net_time < end_time; ++net_time)
@@ -368,13 +436,17 @@ namespace caspian
 
         if(metric == "fire_count")
         {
-            m = metric_fires;
-            metric_fires = 0;
+            uint64_t total = total_activity().fires;
+            m = metric_unread.fires + total - metric_read.fires;
+            metric_unread.fires = 0;
+            metric_read.fires = total;
         }
         else if(metric == "accumulate_count")
         {
-            m = metric_accumulates;
-            metric_accumulates = 0;
+            uint64_t total = total_activity().accumulates;
+            m = metric_unread.accumulates + total - metric_read.accumulates;
+            metric_unread.accumulates = 0;
+            metric_read.accumulates = total;
         }
         else if(metric == "total_timesteps")
         {
@@ -393,13 +465,42 @@ namespace caspian
         return m;
     }
 
+    double Simulator::get_network_metric(const std::string &metric, int network_id)
+    {
+        if(network_id < 0 || network_id >= int(activity.size()))
+            throw std::out_of_range("[get_network_metric] network index is greater than the loaded networks");
+
+        const ActivityCounters &now = activity[network_id];
+        const ActivityCounters &start = run_start_activity[network_id];
+
+        if(metric == "fire_count")
+            return now.fires - start.fires;
+        else if(metric == "accumulate_count")
+            return now.accumulates - start.accumulates;
+
+        std::cerr << "Specified network metric " << metric << " is not implemented\n";
+        return 0;
+    }
+
+    ActivityCounters Simulator::total_activity() const
+    {
+        ActivityCounters total;
+
+        for(auto const &a : activity)
+        {
+            total.fires += a.fires;
+            total.accumulates += a.accumulates;
+        }
+
+        return total;
+    }
+
     void Simulator::reset()
     {
         net_time = 0;
         input_fires.clear();
         thresh_check.clear();
         all_spikes.clear();
-        all_spike_cnts.clear();
 
         for(Network *n : nets)
             n->reset();
@@ -421,7 +522,6 @@ namespace caspian
         input_fires.clear();
         thresh_check.clear();
         all_spikes.clear();
-        all_spike_cnts.clear();
 
         for(Network *n : nets)
             n->clear_activity();
@@ -478,17 +578,35 @@ namespace caspian
 
     std::vector<std::vector<uint32_t>> Simulator::get_all_spikes()
     {
-        return all_spikes;
+        std::vector<std::vector<uint32_t>> spikes(all_spikes.cycles());
+
+        for(size_t t = 0; t < spikes.size(); t++)
+            spikes[t].assign(all_spikes.ids.begin() + all_spikes.offsets[t],
+                             all_spikes.ids.begin() + all_spikes.end(t));
+
+        return spikes;
     }
 
     Simulator::UIntMap Simulator::get_all_spike_cnts()
     {
-        return all_spike_cnts;
+        UIntMap cnts;
+
+        for(uint32_t id : all_spikes.ids)
+            cnts[id]++;
+
+        return cnts;
+    }
+
+    const SpikeBuffer& Simulator::get_spike_buffer() const
+    {
+        return all_spikes;
     }
 
     Simulator::Simulator(bool debug)
     {
         m_debug = debug;
+        activity.resize(1);
+        run_start_activity.resize(1);
     }
 }
 
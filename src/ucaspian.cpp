@@ -305,6 +305,27 @@ namespace caspian
         input_fires.emplace_back(net->get_input(input_id), w, hw_state->net_time + t);
     }
 
+    void UsbCaspian::apply_input(int input_id, int16_t w, uint64_t t, int network_id)
+    {
+        // only a single network is ever loaded on the device
+        if(network_id != 0)
+            throw std::logic_error("Multiple networks are not implemented for uCaspian (yet...)");
+
+        apply_input(input_id, w, t);
+    }
+
+    void UsbCaspian::apply_inputs(const int *input_ids, const int16_t *w, const uint64_t *t,
+                                  size_t count, int network_id)
+    {
+        if(network_id > 0)
+            throw std::logic_error("Multiple networks are not implemented for uCaspian (yet...)");
+
+        input_fires.reserve(input_fires.size() + count);
+
+        for(size_t i = 0; i < count; i++)
+            input_fires.emplace_back(net->get_input(input_ids[i]), w[i], hw_state->net_time + t[i]);
+    }
+
     bool UsbCaspian::configure(Network *new_net)
     {
         std::vector<uint8_t> cfg_buf;
@@ -537,6 +558,14 @@ namespace caspian
         return hw_state->net_time;
     }
 
+    double UsbCaspian::get_network_metric(const std::string& metric, int network_id)
+    {
+        // the device counters reset on read and are not kept per run
+        (void) metric;
+        (void) network_id;
+        throw std::logic_error("Per-run network metrics are not supported on uCaspian");
+    }
+
     double UsbCaspian::get_metric(const std::string& metric)
     {
         auto mit = metric_addrs.find(metric);
@@ -740,6 +769,13 @@ namespace caspian
         return {};
     }
 
+    const SpikeBuffer& UsbCaspian::get_spike_buffer() const
+    {
+        // spikes are not reported by the hardware
+        static const SpikeBuffer empty;
+        return empty;
+    }
+
 }
 
 #undef CFG_ACK
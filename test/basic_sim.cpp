@@ -268,4 +268,54 @@ TEST_CASE("Check functionality of axon and synaptic delay used together")
     delete sim;
 }
 
+TEST_CASE("Bulk input injection matches individual inputs")
+{
+    const int w = 6, h = 8;
+
+    Network net_a, net_b;
+    generate_pass(&net_a, w, h);
+    generate_pass(&net_b, w, h);
+
+    Simulator sim_a, sim_b;
+    sim_a.configure(&net_a);
+    sim_b.configure(&net_b);
+
+    std::vector<int> ids;
+    std::vector<int16_t> weights;
+    std::vector<uint64_t> times;
+
+    for(int i = 0; i < h; ++i)
+    {
+        for(int k = 0; k < 3; ++k)
+        {
+            ids.push_back(i);
+            weights.push_back(100 + 50 * k);
+            times.push_back(3 * i + 5 * k);
+        }
+    }
+
+    for(size_t i = 0; i < ids.size(); ++i)
+        sim_a.apply_input(ids[i], weights[i], times[i]);
+    sim_b.apply_inputs(ids.data(), weights.data(), times.data(), ids.size());
+
+    CHECK_THROWS(sim_b.apply_inputs(ids.data(), weights.data(), times.data(), ids.size(), 1));
+
+    for(int i = 0; i < h; ++i)
+    {
+        sim_a.track_timing(i);
+        sim_b.track_timing(i);
+    }
+
+    sim_a.simulate(100);
+    sim_b.simulate(100);
+
+    for(int i = 0; i < h; ++i)
+    {
+        CHECK(sim_a.get_output_count(i) == 3);
+        CHECK(sim_a.get_output_values(i) == sim_b.get_output_values(i));
+    }
+
+    CHECK(sim_a.get_metric("accumulate_count") == sim_b.get_metric("accumulate_count"));
+}
+
 /* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -0,0 +1,189 @@
+#include "doctest/doctest.h"
+#include "network.hpp"
+#include "simulator.hpp"
+#include "dvs.hpp"
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+using namespace caspian;
+
+TEST_CASE("DVS conversion bins, downsamples, and filters events")
+{
+    DvsConfig cfg;
+    cfg.width = 4;
+    cfg.height = 4;
+    cfg.downsample = 2;
+    cfg.time_bin = 10;
+    cfg.time_offset = 5;
+    cfg.refractory = 2;
+
+    DvsConverter conv(cfg);
+    CHECK(conv.num_inputs() == 2 * 2 * 2);
+
+    //                        kept  early refr  kept  kept  kept  kept  kept
+    std::vector<int32_t> x = {  0,    1,    1,    3,    1,    0,    3,    1 };
+    std::vector<int32_t> y = {  0,    0,    1,    0,    3,    0,    1,    0 };
+    std::vector<int32_t> p = {  0,    0,    0,    1,    0,    1,    1,    0 };
+    std::vector<double>  t = {  5,    4,   20,   14,   31,   35,   29,   40 };
+
+    std::vector<int> ids;
+    std::vector<int16_t> charges;
+    std::vector<uint64_t> times;
+
+    size_t kept = conv.convert(x.data(), y.data(), p.data(), t.data(), x.size(), ids, charges, times);
+
+    CHECK(kept == 6);
+    CHECK(ids == std::vector<int>({0, 5, 2, 4, 5, 0}));
+    CHECK(times == std::vector<uint64_t>({0, 0, 2, 3, 2, 3}));
+    CHECK(charges == std::vector<int16_t>(6, constants::MAX_DEVICE_INPUT));
+
+    // refractory state carries over to the next chunk
+    std::vector<int32_t> x2 = {0}, y2 = {0}, p2 = {0};
+    std::vector<double> t2 = {45};
+    CHECK(conv.convert(x2.data(), y2.data(), p2.data(), t2.data(), 1, ids, charges, times) == 0);
+
+    conv.reset();
+    CHECK(conv.convert(x2.data(), y2.data(), p2.data(), t2.data(), 1, ids, charges, times) == 1);
+
+    std::vector<int32_t> bad = {4};
+    CHECK_THROWS_AS(conv.convert(bad.data(), y2.data(), p2.data(), t2.data(), 1, ids, charges, times), std::out_of_range);
+}
+
+TEST_CASE("DVS bulk injection matches individual inputs")
+{
+    const uint32_t w = 3, h = 2;
+
+    // one input/output neuron per pixel and polarity
+    Network net_a, net_b;
+    for(Network *net : {&net_a, &net_b})
+    {
+        for(uint32_t i = 0; i < 2 * w * h; i++)
+        {
+            net->add_neuron(i, 0);
+            net->set_input(i, i);
+            net->set_output(i, i);
+        }
+    }
+
+    std::vector<int32_t> x, y, p;
+    std::vector<double> t;
+    for(int i = 0; i < 40; i++)
+    {
+        x.push_back((i * 7) % w);
+        y.push_back((i * 3) % h);
+        p.push_back(i % 3 == 0);
+        t.push_back(i * 1.7);
+    }
+
+    Simulator sim_a, sim_b;
+    sim_a.configure(&net_a);
+    sim_b.configure(&net_b);
+
+    // what the binding used to do, one event at a time
+    for(size_t i = 0; i < x.size(); i++)
+        sim_a.apply_input(y[i] * w + x[i] + p[i] * w * h, constants::MAX_DEVICE_INPUT, uint64_t(t[i]));
+
+    DvsConfig cfg;
+    cfg.width = w;
+    cfg.height = h;
+    DvsConverter conv(cfg);
+    CHECK(conv.apply(&sim_b, x.data(), y.data(), p.data(), t.data(), x.size()) == x.size());
+
+    for(uint32_t i = 0; i < 2 * w * h; i++)
+    {
+        sim_a.track_timing(i);
+        sim_b.track_timing(i);
+    }
+
+    sim_a.simulate(100);
+    sim_b.simulate(100);
+
+    for(uint32_t i = 0; i < 2 * w * h; i++)
+    {
+        CHECK(sim_a.get_output_values(i) == sim_b.get_output_values(i));
+        CHECK(sim_a.get_output_count(i) == sim_b.get_output_count(i));
+    }
+}
+
+TEST_CASE("DVS files are decoded and replayed in time windows")
+{
+    const std::string path = "dvs_file_test.bin";
+
+    // N-MNIST records: x, y, then polarity in the top bit above a 23 bit timestamp
+    std::vector<int32_t> x = {1, 3, 0, 2, 1, 3};
+    std::vector<int32_t> y = {0, 1, 1, 0, 1, 0};
+    std::vector<int32_t> p = {0, 1, 1, 0, 1, 0};
+    std::vector<double>  t = {3, 17, 17, 250, 4000000, 8000000};
+
+    {
+        std::ofstream out(path, std::ios::binary);
+        for(size_t i = 0; i < x.size(); i++)
+        {
+            uint32_t ts = t[i];
+            uint8_t rec[5] = {uint8_t(x[i]), uint8_t(y[i]), uint8_t((p[i] << 7) | (ts >> 16)),
+                              uint8_t(ts >> 8), uint8_t(ts)};
+            out.write(reinterpret_cast<const char*>(rec), 5);
+        }
+    }
+
+    {
+        DvsFile file(path, DvsLayout::nmnist());
+        REQUIRE(file.size() == x.size());
+        CHECK(file.time(5) == 8000000);
+        CHECK(file.find(17) == 1);
+        CHECK(file.find(18) == 3);
+        CHECK(file.find(1e9) == x.size());
+
+        std::vector<int32_t> rx(x.size()), ry(x.size()), rp(x.size());
+        std::vector<double> rt(x.size());
+        file.read(0, x.size(), rx.data(), ry.data(), rp.data(), rt.data());
+        CHECK(rx == x);
+        CHECK(ry == y);
+        CHECK(rp == p);
+        CHECK(rt == t);
+
+        DvsLayout bad = DvsLayout::nmnist();
+        bad.p.shift = 64;
+        CHECK_THROWS_AS(DvsFile(path, bad), std::invalid_argument);
+        bad = DvsLayout::nmnist();
+        bad.t.bits = 0;
+        CHECK_THROWS_AS(DvsFile(path, bad), std::invalid_argument);
+
+        // one network input per pixel and polarity, each firing straight to an output
+        Network net;
+        for(uint32_t i = 0; i < 2 * 4 * 2; i++)
+        {
+            net.add_neuron(i, 0);
+            net.set_input(i, i);
+            net.set_output(i, i);
+        }
+
+        Simulator sim;
+        sim.configure(&net);
+        for(uint32_t i = 0; i < net.num_outputs(); i++)
+            sim.track_timing(i);
+
+        DvsConfig cfg;
+        cfg.width = 4;
+        cfg.height = 2;
+        cfg.time_bin = 10;
+        DvsConverter conv(cfg);
+
+        // outputs fire a cycle after their input; the second window starts at cycle 10
+        // and its events are relative to that
+        CHECK(file.apply_window(conv, &sim, 0, 100, -1) == 3);
+        sim.simulate(10);
+        CHECK(sim.get_output_values(1) == std::vector<uint32_t>({1}));
+        CHECK(sim.get_output_values(8 + 7) == std::vector<uint32_t>({2}));
+        CHECK(sim.get_output_values(8 + 4) == std::vector<uint32_t>({2}));
+
+        CHECK(file.apply_window(conv, &sim, 100, 300, -1) == 1);
+        sim.simulate(20);
+        CHECK(sim.get_output_values(2) == std::vector<uint32_t>({16}));
+    }
+
+    std::remove(path.c_str());
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -108,3 +108,173 @@ TEST_CASE("Simulation of a Straight Pass Network")
     networks.clear();
     
 }
+
+TEST_CASE("Routed inputs only reach their own network of a batch")
+{
+    const int h = 2;
+    const int nt = 6;
+    const int stime = 30;
+
+    Simulator sim;
+    std::vector<Network*> networks;
+
+    for(int i = 0; i < nt; i++)
+    {
+        Network *net = new Network();
+        generate_pass(net, 4, h, 1);
+        networks.push_back(net);
+    }
+
+    REQUIRE(sim.configure_multi(networks));
+
+    // network i gets i+1 spikes on input 0, odd networks also get one spike on input 1
+    for(int i = 0; i < nt; i++)
+    {
+        for(int k = 0; k <= i; k++)
+            sim.apply_input(0, 500, 2*k, i);
+
+        if(i % 2 == 1)
+            sim.apply_input(1, 500, 0, i);
+    }
+
+    CHECK_THROWS(sim.apply_input(0, 500, 0, nt));
+
+    sim.simulate(stime);
+
+    for(int i = 0; i < nt; i++)
+    {
+        CHECK(sim.get_output_count(0, i) == i+1);
+        CHECK(sim.get_output_count(1, i) == (i % 2));
+    }
+
+    // broadcast inputs still reach every network
+    sim.apply_input(1, 500, 0);
+    sim.simulate(stime);
+
+    for(int i = 0; i < nt; i++)
+    {
+        CHECK(sim.get_output_count(0, i) == 0);
+        CHECK(sim.get_output_count(1, i) == 1);
+    }
+
+    for(size_t i = 0; i < networks.size(); i++)
+        delete networks[i];
+}
+
+TEST_CASE("Spike buffer records every spike with its network")
+{
+    const int h = 2;
+    const int nt = 3;
+
+    Simulator sim;
+    std::vector<Network*> networks;
+
+    for(int i = 0; i < nt; i++)
+    {
+        Network *net = new Network();
+        generate_pass(net, 3 + i, h, 1);
+        networks.push_back(net);
+    }
+
+    REQUIRE(sim.configure_multi(networks));
+    sim.collect_all_spikes();
+
+    sim.apply_input(0, 500, 0);
+    sim.simulate(20);
+
+    const SpikeBuffer &sb = sim.get_spike_buffer();
+    auto all = sim.get_all_spikes();
+
+    REQUIRE(sb.cycles() == 20);
+    REQUIRE(all.size() == 20);
+    CHECK(sb.nets.size() == sb.ids.size());
+
+    // every neuron of row 0 fires exactly once, in order along the row
+    std::vector<int> counts(nt, 0);
+    size_t total = 0;
+
+    for(size_t t = 0; t < sb.cycles(); t++)
+    {
+        CHECK(all[t].size() == sb.end(t) - sb.offsets[t]);
+        total += all[t].size();
+
+        for(size_t k = sb.offsets[t]; k < sb.end(t); k++)
+        {
+            int net_id = sb.nets[k];
+            CHECK(sb.ids[k] == uint32_t(counts[net_id]));
+            CHECK(t == size_t(2*counts[net_id] + 1));
+            counts[net_id]++;
+        }
+    }
+
+    CHECK(total == sb.ids.size());
+    for(int i = 0; i < nt; i++)
+        CHECK(counts[i] == 3 + i);
+
+    // a single network records no network indices
+    REQUIRE(sim.configure(networks[0]));
+    sim.reset();
+    sim.collect_all_spikes();
+    sim.apply_input(0, 500, 0);
+    sim.simulate(20);
+
+    CHECK(sim.get_spike_buffer().ids.size() == 3);
+    CHECK(sim.get_spike_buffer().nets.empty());
+    CHECK(sim.get_all_spike_cnts()[2] == 1);
+
+    for(size_t i = 0; i < networks.size(); i++)
+        delete networks[i];
+}
+
+TEST_CASE("Activity is counted per network of a batch")
+{
+    const int h = 2;
+    const int nt = 5;
+
+    Simulator sim;
+    std::vector<Network*> networks;
+
+    for(int i = 0; i < nt; i++)
+    {
+        Network *net = new Network();
+        generate_pass(net, 2 + i, h, 1);
+        networks.push_back(net);
+    }
+
+    REQUIRE(sim.configure_multi(networks));
+
+    // one spike down row 0 of every network: a pass of width w fires w times
+    sim.apply_input(0, 500, 0);
+    sim.simulate(40);
+
+    uint64_t fires = 0;
+    for(int i = 0; i < nt; i++)
+    {
+        CHECK(sim.get_network_metric("fire_count", i) == 2 + i);
+        CHECK(sim.get_network_metric("accumulate_count", i) == 2 + i);
+        fires += 2 + i;
+    }
+
+    CHECK_THROWS(sim.get_network_metric("fire_count", nt));
+
+    // only the last run is reported per network; the global metric resets on read
+    sim.apply_input(1, 500, 0, 3);
+    sim.simulate(40);
+
+    for(int i = 0; i < nt; i++)
+        CHECK(sim.get_network_metric("fire_count", i) == ((i == 3) ? 5 : 0));
+
+    CHECK(sim.get_metric("fire_count") == fires + 5);
+    CHECK(sim.get_metric("fire_count") == 0);
+
+    // unread activity survives a reconfiguration
+    sim.apply_input(0, 500, 0, 0);
+    sim.simulate(40);
+    REQUIRE(sim.configure(networks[1]));
+
+    CHECK(sim.get_metric("fire_count") == 2);
+    CHECK(sim.get_network_metric("fire_count", 0) == 0);
+
+    for(size_t i = 0; i < networks.size(); i++)
+        delete networks[i];
+}
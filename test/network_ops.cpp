@@ -1,7 +1,12 @@
 #include <vector>
 #include <algorithm>
+#include <cstdlib>
 #include "doctest/doctest.h"
 #include "network.hpp"
+#include "archive.hpp"
+#include "network_analysis.hpp"
+#include "network_diff.hpp"
+#include "byte_stream.hpp"
 #include "simulator.hpp"
 
 using namespace caspian;
@@ -142,6 +147,83 @@ TEST_CASE("Network metrics are correctly reported")
     REQUIRE(net.num_synapses() == 0);
 }
 
+static void check_stats(Network &net)
+{
+    // compare the incremental statistics against a full rebuild
+    NetworkStats inc = net.get_stats();
+    net.rebuild_stats();
+    const NetworkStats &full = net.get_stats();
+
+    CHECK(inc.positive_synapses() == full.positive_synapses());
+    CHECK(inc.negative_synapses() == full.negative_synapses());
+    CHECK(inc.fan_in_histogram() == full.fan_in_histogram());
+    CHECK(inc.fan_out_histogram() == full.fan_out_histogram());
+    CHECK(inc.synapse_delay_histogram() == full.synapse_delay_histogram());
+    CHECK(inc.axon_delay_histogram() == full.axon_delay_histogram());
+    CHECK(inc.max_fan_in() == full.max_fan_in());
+    CHECK(inc.max_fan_out() == full.max_fan_out());
+    CHECK(inc.mean_synapse_delay() == full.mean_synapse_delay());
+    CHECK(inc.mean_axon_delay() == full.mean_axon_delay());
+}
+
+TEST_CASE("Network statistics are maintained incrementally")
+{
+    Network net(100);
+    net.make_random(5, 5, 7, 10, 10, 6, 8);
+    check_stats(net);
+
+    // fan-out metrics
+    size_t max_out = 0, max_in = 0;
+    for(uint32_t nid : net.get_neuron_list())
+    {
+        max_out = std::max(max_out, net.get_neuron(nid).outputs.size());
+        max_in = std::max(max_in, net.get_neuron(nid).synapses.size());
+    }
+    CHECK(net.get_metric("max_fan_out") == max_out);
+    CHECK(net.get_metric("max_fan_in") == max_in);
+
+    // overwrite, single removals, and neuron changes
+    std::vector<std::pair<uint32_t, uint32_t>> syns = net.get_synapse_list();
+    for(size_t i = 0; i < syns.size(); i += 7)
+        net.add_synapse(syns[i].first, syns[i].second, -3, 9);
+    for(size_t i = 3; i < syns.size(); i += 11)
+        net.remove_synapse(syns[i].first, syns[i].second);
+    net.add_neuron(20, 10, -1, 4);
+    net.remove_neuron(30);
+    check_stats(net);
+
+    // bulk removals
+    net.remove_neurons({40, 41, 42, 43, 44, 45});
+    syns = net.get_synapse_list();
+    std::vector<std::pair<uint32_t, uint32_t>> doomed(syns.begin(), syns.begin() + syns.size() / 3);
+    net.remove_synapses(doomed);
+    check_stats(net);
+
+    // copy, move, and binary round trip
+    Network cnet(net);
+    check_stats(cnet);
+    CHECK(cnet.get_stats().fan_in_histogram() == net.get_stats().fan_in_histogram());
+
+    Network mnet(std::move(cnet));
+    check_stats(mnet);
+    CHECK(mnet.get_stats().fan_out_histogram() == net.get_stats().fan_out_histogram());
+
+    Network bnet;
+    std::vector<uint8_t> buf = net.to_bytes();
+    bnet.from_bytes(buf.data(), buf.size());
+    check_stats(bnet);
+
+    net.prune();
+    check_stats(net);
+
+    // purge clears everything
+    net.purge_elements();
+    CHECK(net.get_neuron_list().empty());
+    CHECK(net.get_stats().max_fan_in() == 0);
+    CHECK(net.get_stats().fan_out_histogram().empty());
+    CHECK(net.get_metric("mean_synapse_delay") == 0);
+}
+
 TEST_CASE("Synapses may be added, retrieved, and deleted")
 {
     Network net(5);
@@ -241,6 +323,55 @@ TEST_CASE("Networks can be copy constructed")
     CHECK(s.delay == 1);
 }
 
+TEST_CASE("Structural hash is independent of construction order")
+{
+    Network a(10), b(10);
+
+    a.add_neuron(0, 1);
+    a.add_neuron(1, 2, 1);
+    a.add_neuron(4, 3, -1, 2);
+    a.add_synapse(0, 1, 10, 1);
+    a.add_synapse(0, 4, 20, 1);
+    a.add_synapse(4, 0, -5, 2);
+    a.set_input(0, 0);
+    a.set_output(4, 0);
+
+    b.add_neuron(4, 3, -1, 2);
+    b.add_neuron(1, 2, 1);
+    b.add_neuron(0, 1);
+    b.add_synapse(4, 0, -5, 2);
+    b.add_synapse(0, 4, 20, 1);
+    b.add_synapse(0, 1, 10, 1);
+    b.set_output(4, 0);
+    b.set_input(0, 0);
+
+    CHECK(a == b);
+    CHECK(a.structural_hash() == b.structural_hash());
+    CHECK(Network(a).structural_hash() == a.structural_hash());
+
+    // activity does not matter
+    b.get_neuron(1).charge = 7;
+    b.set_time(100);
+    CHECK(a.structural_hash() == b.structural_hash());
+
+    // any structural change does
+    b.get_synapse(0, 4).weight = 21;
+    CHECK(a.structural_hash() != b.structural_hash());
+    b.get_synapse(0, 4).weight = 20;
+
+    b.get_neuron(1).leak = 2;
+    CHECK(a.structural_hash() != b.structural_hash());
+    b.get_neuron(1).leak = 1;
+
+    b.remove_synapse(0, 1);
+    CHECK(a.structural_hash() != b.structural_hash());
+    b.add_synapse(0, 1, 10, 1);
+    CHECK(a.structural_hash() == b.structural_hash());
+
+    b.set_output(1, 1);
+    CHECK(a.structural_hash() != b.structural_hash());
+}
+
 TEST_CASE("Networks can be pruned of useless neurons")
 {
     Network net(10);
@@ -393,6 +524,50 @@ TEST_CASE("Networks can be pruned of unused i/o neurons")
 }
 
 
+TEST_CASE("Reachability analysis handles deep chains")
+{
+    const uint32_t len = 200000;
+    Network net(len + 2);
+
+    // long chain from the input to the output plus a dead end hanging off of it
+    for(uint32_t i = 0; i < len; ++i)
+    {
+        net.add_neuron(i, 0);
+        if(i > 0) net.add_synapse(i-1, i, 1);
+    }
+
+    net.add_neuron(len, 0);
+    net.add_synapse(len/2, len, 1);
+    net.add_neuron(len+1, 0);
+    net.add_synapse(len+1, len-1, 1);
+
+    net.set_input(0, 0);
+    net.set_output(len-1, 0);
+
+    NetworkAnalysis analysis(net);
+    REQUIRE(analysis.size() == len + 2);
+
+    Bitset fwd = analysis.forward_reachable();
+    Bitset bwd = analysis.backward_reachable();
+    CHECK(fwd.count() == len + 1);
+    CHECK(bwd.count() == len + 1);
+    CHECK(analysis.live().count() == len);
+
+    CHECK(fwd.test(analysis.index_of(len)));
+    CHECK_FALSE(bwd.test(analysis.index_of(len)));
+    CHECK_FALSE(fwd.test(analysis.index_of(len+1)));
+    CHECK(bwd.test(analysis.index_of(len+1)));
+    CHECK(analysis.index_of(len+2) == -1);
+
+    net.prune();
+    CHECK(net.num_neurons() == len);
+    CHECK(net.num_synapses() == len - 1);
+    CHECK_FALSE(net.is_neuron(len));
+    CHECK_FALSE(net.is_neuron(len+1));
+    CHECK(net.get_neuron(len/2).outputs.size() == 1);
+    CHECK(net.get_neuron(len-1).synapses.size() == 1);
+}
+
 TEST_CASE("Network Serialization")
 {
     Network net(20);
@@ -460,4 +635,324 @@ TEST_CASE("Network Serialization")
     }
 }
 
+TEST_CASE("Binary Serialization")
+{
+    Network net(30);
+    net.make_random(4, 3, 1234, 6, 6, 4, 6);
+    net.soft_reset = true;
+
+    std::vector<uint8_t> buf = net.to_bytes();
+
+    Network bnet;
+    REQUIRE(bnet.from_bytes(buf.data(), buf.size()) == buf.size());
+
+    CHECK(bnet == net);
+    CHECK(bnet.get_max_size() == net.get_max_size());
+    CHECK(bnet.get_neuron_list().size() == net.num_neurons());
+    CHECK(bnet.get_synapse_list().size() == net.num_synapses());
+
+    for(auto elm : net)
+    {
+        Neuron &n = bnet.get_neuron(elm.first);
+        CHECK(n.delay == elm.second->delay);
+        CHECK(n.outputs.size() == elm.second->outputs.size());
+
+        for(auto &p : n.outputs)
+            CHECK(p.second == bnet.get_synapse_ptr(n.id, p.first->id));
+    }
+
+    // truncated records are rejected
+    Network tnet;
+    CHECK_THROWS(tnet.from_bytes(buf.data(), buf.size() / 2));
+
+    // hand-built record: neurons 0 and 1, output 0 on neuron `output`, synapses 0 -> 1 and
+    // 1 -> 1 with delay 9, and stored maxima of 0
+    auto record = [](uint64_t n_neurons, uint64_t nid_delta, uint64_t from_delta,
+                     int64_t thresh = 5, int64_t output = 1) {
+        std::vector<uint8_t> b;
+        ByteWriter w(b);
+        w.u8(constants::BINARY_FORMAT_VER);
+        w.uvar(10); w.uvar(255); w.u8(0); w.u8(0); w.u8(0);    // size, max_thresh, soft_reset, delays
+        w.uvar(n_neurons);
+        w.uvar(0); w.svar(5); w.svar(-1); w.u8(0);
+        w.uvar(nid_delta); w.svar(thresh); w.svar(-1); w.u8(2);
+        w.uvar(0); w.uvar(1); w.svar(output);                   // no inputs, one output
+        w.uvar(2);                                              // synapse count
+        w.uvar(0);                                              // fan-in of neuron 0
+        w.uvar(2); w.uvar(0); w.svar(7); w.u8(9); w.uvar(from_delta); w.svar(7); w.u8(9);
+        return b;
+    };
+
+    std::vector<uint8_t> good = record(2, 1, 1);
+    Network gnet;
+    REQUIRE(gnet.from_bytes(good.data(), good.size()) == good.size());
+    CHECK(gnet.num_synapses() == 2);
+    CHECK(gnet.max_syn_delay == 9);
+    CHECK(gnet.max_axon_delay == 2);
+    CHECK(gnet.get_neuron(1).output_id == 0);
+
+    std::vector<uint8_t> dup_neuron = record(2, 0, 1);
+    CHECK_THROWS(tnet.from_bytes(dup_neuron.data(), dup_neuron.size()));
+
+    std::vector<uint8_t> dup_synapse = record(2, 1, 0);
+    CHECK_THROWS(tnet.from_bytes(dup_synapse.data(), dup_synapse.size()));
+
+    std::vector<uint8_t> huge = record(uint64_t(1) << 40, 1, 1);
+    CHECK_THROWS(tnet.from_bytes(huge.data(), huge.size()));
+
+    std::vector<uint8_t> dangling = record(2, 1, 1, 5, 7);
+    CHECK_THROWS(tnet.from_bytes(dangling.data(), dangling.size()));
+
+    std::vector<uint8_t> wide = record(2, 1, 1, 40000);
+    CHECK_THROWS(tnet.from_bytes(wide.data(), wide.size()));
+}
+
+TEST_CASE("Networks round trip through flat arrays")
+{
+    Network net(30);
+    net.make_random(4, 3, 4321, 6, 6, 4, 6);
+    net.soft_reset = true;
+    net.max_thresh = 300;
+
+    NetworkArrays a = net.to_arrays();
+    CHECK(a.neuron_ids.size() == net.num_neurons());
+    CHECK(a.src.size() == net.num_synapses());
+    CHECK(std::is_sorted(a.neuron_ids.begin(), a.neuron_ids.end()));
+
+    Network anet;
+    anet.from_arrays(a);
+
+    CHECK(anet == net);
+    CHECK(anet.structural_hash() == net.structural_hash());
+    CHECK(anet.get_max_size() == 30);
+    CHECK(anet.get_stats().positive_synapses() == net.get_stats().positive_synapses());
+    CHECK(anet.get_stats().fan_in_histogram() == net.get_stats().fan_in_histogram());
+    CHECK(anet.get_stats().fan_out_histogram() == net.get_stats().fan_out_histogram());
+
+    // synapse order does not matter, and a repeated synapse keeps its last entry
+    NetworkArrays r = a;
+    std::reverse(r.src.begin(), r.src.end());
+    std::reverse(r.dst.begin(), r.dst.end());
+    std::reverse(r.weights.begin(), r.weights.end());
+    std::reverse(r.syn_delays.begin(), r.syn_delays.end());
+
+    r.src.push_back(a.src[0]);
+    r.dst.push_back(a.dst[0]);
+    r.weights.push_back(a.weights[0]);
+    r.syn_delays.push_back(a.syn_delays[0]);
+    r.weights[a.src.size() - 1] = -1;
+
+    Network rnet(30);
+    rnet.from_arrays(r);
+    CHECK(rnet == net);
+    CHECK(rnet.num_synapses() == net.num_synapses());
+
+    for(auto elm : rnet)
+        for(auto &p : elm.second->outputs)
+            CHECK(p.second == rnet.get_synapse_ptr(elm.first, p.first->id));
+
+    // matches element-wise construction
+    Network enet(30);
+    for(size_t i = 0; i < a.neuron_ids.size(); i++)
+        enet.add_neuron(a.neuron_ids[i], a.thresholds[i], a.leaks[i], a.delays[i]);
+    for(size_t i = 0; i < a.src.size(); i++)
+        enet.add_synapse(a.src[i], a.dst[i], a.weights[i], a.syn_delays[i]);
+    for(size_t i = 0; i < a.inputs.size(); i++)
+        enet.set_input(a.inputs[i], i);
+    for(size_t i = 0; i < a.outputs.size(); i++)
+        enet.set_output(a.outputs[i], i);
+    enet.soft_reset = true;
+    enet.max_thresh = 300;
+
+    CHECK(enet == anet);
+
+    // a reused network does not keep the delay maxima of its old contents
+    Network reused(30);
+    reused.add_neuron(0, 1, -1, 200);
+    reused.add_neuron(1, 1);
+    reused.add_synapse(0, 1, 1, 250);
+    reused.from_arrays(a);
+    CHECK(reused.structural_hash() == anet.structural_hash());
+
+    // bad references are rejected
+    NetworkArrays bad = a;
+    bad.dst[0] = 1000;
+    CHECK_THROWS_AS(rnet.from_arrays(bad), std::invalid_argument);
+
+    bad = a;
+    bad.neuron_ids[1] = bad.neuron_ids[0];
+    CHECK_THROWS_AS(rnet.from_arrays(bad), std::invalid_argument);
+
+    bad = a;
+    bad.outputs[0] = 1000;
+    CHECK_THROWS_AS(rnet.from_arrays(bad), std::invalid_argument);
+}
+
+TEST_CASE("Population archives round trip networks")
+{
+    const std::string path = "population_archive_test.bin";
+    std::vector<Network*> pop;
+
+    for(int i = 0; i < 5; i++)
+    {
+        pop.push_back(new Network(20 + i));
+        pop.back()->make_random(3, 2, i, 4, 4, 3, 5);
+    }
+
+    write_population_archive(path, pop);
+
+    {
+        PopulationArchive archive(path);
+        REQUIRE(archive.size() == pop.size());
+
+        for(size_t i = 0; i < pop.size(); i++)
+        {
+            Network *net = archive.load(i);
+            CHECK(*net == *pop[i]);
+            delete net;
+        }
+
+        CHECK_THROWS(archive.record(pop.size()));
+    }
+
+    std::remove(path.c_str());
+
+    for(Network *n : pop)
+        delete n;
+}
+
+TEST_CASE("Bulk random generation is deterministic across thread counts")
+{
+    RandomNetworkParams params;
+    params.n_inputs = 4;
+    params.n_outputs = 3;
+    params.n_input_synapses = 8;
+    params.n_output_synapses = 8;
+    params.n_hidden_synapses = 6;
+    params.n_hidden_synapses_max = 7;
+
+    std::vector<Network*> a = make_random_networks(16, 50, 42, params, 1);
+    std::vector<Network*> b = make_random_networks(16, 50, 42, params, 4);
+    std::vector<Network*> c = make_random_networks(16, 50, 43, params, 4);
+
+    REQUIRE(a.size() == 16);
+    REQUIRE(b.size() == 16);
+
+    for(size_t i = 0; i < a.size(); i++)
+    {
+        CHECK(*a[i] == *b[i]);
+        CHECK(a[i]->structural_hash() == b[i]->structural_hash());
+        CHECK(a[i]->structural_hash() != c[i]->structural_hash());
+
+        CHECK(a[i]->num_neurons() == 50);
+        CHECK(a[i]->num_inputs() == 4);
+        CHECK(a[i]->num_outputs() == 3);
+        CHECK(a[i]->num_synapses() == a[i]->get_synapse_list().size());
+
+        for(uint32_t nid : a[i]->get_neuron_list())
+        {
+            Neuron &n = a[i]->get_neuron(nid);
+            CHECK(n.threshold >= 0);
+            CHECK(n.threshold <= 255);
+            if(n.input_id >= 0) CHECK(n.synapses.empty());
+
+            for(auto const &syn : n.synapses)
+            {
+                CHECK(syn.second.delay <= 15);
+                CHECK(std::abs(syn.second.weight) <= 255);
+            }
+        }
+
+        // the copy must be a fully functional network
+        Network cnet(*a[i]);
+        CHECK(cnet == *a[i]);
+    }
+
+    // distinct networks within the population
+    CHECK(a[0]->structural_hash() != a[1]->structural_hash());
+
+    params.n_inputs = 40;
+    CHECK_THROWS(make_random_networks(2, 20, 1, params));
+
+    for(auto v : {a, b, c})
+        for(Network *n : v)
+            delete n;
+}
+
+TEST_CASE("Network diffs patch a base network into the target")
+{
+    Network base(60);
+    base.make_random(4, 3, 99, 8, 8, 5, 6);
+
+    Network target(base);
+
+    // no changes => empty diff
+    NetworkDiff d0 = target.diff(base);
+    CHECK(d0.empty());
+
+    // mutate: remove neurons & synapses, add neurons & synapses, change parameters & i/o
+    target.remove_neuron(20);
+    target.remove_neuron(21);
+    std::vector<std::pair<uint32_t, uint32_t>> syns = target.get_synapse_list();
+    target.remove_synapse(syns[0].first, syns[0].second);
+    target.remove_synapse(syns[1].first, syns[1].second);
+    target.add_synapse(syns[2].first, syns[2].second, -7, 3);
+    target.add_neuron(100, 42, 2, 1);
+    target.add_synapse(100, 30, 55, 2);
+    target.add_synapse(0, 100, 60, 0);
+    target.add_neuron(25, 17, -1, 3);
+    target.set_output(100, 3);
+    target.soft_reset = true;
+
+    NetworkDiff d = target.diff(base);
+    CHECK_FALSE(d.empty());
+    CHECK(d.removed_neurons.size() == 2);
+    CHECK(d.io_changed);
+
+    // round trip through the binary encoding
+    std::vector<uint8_t> buf = d.to_bytes();
+    CHECK(buf.size() < base.to_bytes().size() / 4);
+
+    NetworkDiff rd;
+    CHECK(rd.from_bytes(buf.data(), buf.size()) == buf.size());
+
+    Network patched(base);
+    patched.apply_patch(rd);
+
+    CHECK(patched == target);
+    CHECK(patched.structural_hash() == target.structural_hash());
+    CHECK(patched.get_neuron(100).output_id == 3);
+    CHECK(patched.get_metric("excitatory_synapse_count") == target.get_metric("excitatory_synapse_count"));
+
+    // the patch only applies to its base
+    CHECK_THROWS(patched.apply_patch(rd));
+    CHECK_THROWS(rd.from_bytes(buf.data(), buf.size() / 2));
+
+    // a corrupt count is rejected before anything is sized from it
+    std::vector<uint8_t> huge(buf.begin(), buf.begin() + 1 + 16);
+    ByteWriter w(huge);
+    w.uvar(d.max_thresh); w.u8(0); w.u8(0); w.u8(0);
+    w.uvar(uint64_t(1) << 40);
+    CHECK_THROWS_AS(rd.from_bytes(huge.data(), huge.size()), std::runtime_error);
+}
+
+TEST_CASE("Network diffs of configuration changes are not empty")
+{
+    Network base(20);
+    base.make_random(3, 2, 7, 4, 4, 3, 4);
+
+    Network target(base);
+    target.soft_reset = !base.soft_reset;
+
+    NetworkDiff d = target.diff(base);
+    CHECK_FALSE(d.empty());
+    CHECK(d.neurons.empty());
+    CHECK(d.synapses.empty());
+
+    Network patched(base);
+    patched.apply_patch(d);
+    CHECK(patched.soft_reset == target.soft_reset);
+    CHECK(patched.structural_hash() == target.structural_hash());
+}
+
 /* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
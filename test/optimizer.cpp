@@ -0,0 +1,139 @@
+#include "doctest/doctest.h"
+#include "network.hpp"
+#include "optimizer.hpp"
+#include "simulator.hpp"
+#include <vector>
+#include <random>
+
+using namespace caspian;
+
+typedef std::vector<std::vector<uint32_t>> OutputTimes;
+
+static OutputTimes run_network(Network *net, const std::vector<std::tuple<int, int16_t, uint64_t>> &inputs, uint64_t steps)
+{
+    Simulator sim;
+    OutputTimes times;
+
+    net->reset();
+    sim.configure(net);
+
+    for(uint32_t i = 0; i < net->num_outputs(); ++i)
+        sim.track_timing(i);
+
+    for(auto const &in : inputs)
+        sim.apply_input(std::get<0>(in), std::get<1>(in), std::get<2>(in));
+
+    sim.simulate(steps);
+
+    for(uint32_t i = 0; i < net->num_outputs(); ++i)
+        times.push_back(sim.get_output_values(i));
+
+    sim.configure(nullptr);
+
+    return times;
+}
+
+static void generate_random(Network *net, std::mt19937 &gen, int n_neurons, int n_synapses, int n_inputs, int n_outputs)
+{
+    std::uniform_int_distribution<int> thresh(0, 200);
+    std::uniform_int_distribution<int> weight(-64, 255);
+    std::uniform_int_distribution<int> delay(0, 15);
+    std::uniform_int_distribution<int> coin(0, 3);
+    std::uniform_int_distribution<int> nid(0, n_neurons-1);
+
+    net->soft_reset = (coin(gen) == 0);
+
+    for(int i = 0; i < n_neurons; i++)
+        net->add_neuron(i, thresh(gen), (coin(gen) == 0) ? 2 : -1, (coin(gen) == 0) ? delay(gen) : 0);
+
+    for(int i = 0; i < n_synapses; i++)
+    {
+        uint32_t from = nid(gen);
+        uint32_t to = nid(gen);
+        if(net->is_synapse(from, to)) continue;
+        net->add_synapse(from, to, (coin(gen) == 0) ? 0 : weight(gen), delay(gen));
+    }
+
+    for(int i = 0; i < n_inputs; i++)
+        net->set_input(i, i);
+
+    for(int i = 0; i < n_outputs; i++)
+        net->set_output(n_neurons - 1 - i, i);
+}
+
+TEST_CASE("Optimizer folds relay chains without changing output timing")
+{
+    Network net;
+
+    // input -> 4 relay hops -> output, with a dead branch and a silent neuron
+    net.add_neuron(0, 0);
+    for(int i = 1; i <= 4; i++)
+    {
+        net.add_neuron(i, 10, -1, i % 2);
+        net.add_synapse(i-1, i, 100, 2);
+    }
+    net.add_neuron(5, 50);
+    net.add_synapse(4, 5, 60, 1);
+    net.add_neuron(6, 0);
+    net.add_synapse(2, 6, 100, 0);
+    net.add_neuron(7, 0);
+    net.add_synapse(7, 5, 100, 0);
+
+    net.set_input(0, 0);
+    net.set_output(5, 0);
+
+    std::vector<std::tuple<int, int16_t, uint64_t>> inputs = {
+        std::make_tuple(0, 100, 0), std::make_tuple(0, 100, 1), std::make_tuple(0, 100, 5)
+    };
+
+    OutputTimes before = run_network(&net, inputs, 100);
+    OptimizerReport report = optimize_network(net);
+    OutputTimes after = run_network(&net, inputs, 100);
+
+    CHECK(before == after);
+    CHECK(before[0].size() == 3);
+
+    CHECK(report.neurons_before == 8);
+    CHECK(report.neurons_after == 2);
+    CHECK(net.num_synapses() == 1);
+    CHECK(net.get_synapse(0, 5).delay == 4*2 + 1 + 4 + (1+0+1+0));
+    CHECK(report.to_json()["passes"].size() == 4);
+}
+
+TEST_CASE("Optimizer preserves output timing of random networks")
+{
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<int> in_w(1, 255);
+    std::uniform_int_distribution<int> in_t(0, 99);
+    size_t removed[4] = {0, 0, 0, 0};
+
+    for(int trial = 0; trial < 200; trial++)
+    {
+        Network net;
+        generate_random(&net, gen, 40, 120, 4, 4);
+
+        std::vector<std::tuple<int, int16_t, uint64_t>> inputs;
+        for(int i = 0; i < 60; i++)
+            inputs.emplace_back(i % 4, in_w(gen), in_t(gen));
+
+        OutputTimes before = run_network(&net, inputs, 400);
+
+        size_t n_neurons = net.num_neurons();
+        OptimizerReport report = optimize_network(net);
+
+        OutputTimes after = run_network(&net, inputs, 400);
+
+        CHECK(before == after);
+        CHECK(report.neurons_after == net.num_neurons());
+        CHECK(net.num_neurons() <= n_neurons);
+
+        for(int p = 0; p < 4; p++)
+            removed[p] += report.passes[p].neurons_removed + report.passes[p].synapses_removed;
+    }
+
+    // every pass should have had something to do
+    for(int p = 0; p < 4; p++)
+        CHECK(removed[p] > 0);
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -0,0 +1,42 @@
+#include "doctest/doctest.h"
+#include "worker_pool.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace caspian;
+
+TEST_CASE("Worker pool runs every job on all workers and can be reused")
+{
+    WorkerPool pool(4);
+    REQUIRE(pool.size() == 4);
+
+    std::vector<int> per_worker(pool.size(), 0);
+    std::atomic<size_t> next(0);
+    std::vector<int> items(1000, 0);
+
+    for(int round = 1; round <= 50; round++)
+    {
+        next = 0;
+        pool.run([&](int w) {
+            per_worker[w]++;
+            size_t i;
+            while((i = next.fetch_add(1)) < items.size())
+                items[i]++;
+        });
+    }
+
+    for(int c : per_worker)
+        CHECK(c == 50);
+    for(int v : items)
+        CHECK(v == 50);
+
+    // a failing worker is reported without breaking the pool
+    CHECK_THROWS_AS(pool.run([](int w) { if(w == 2) throw std::runtime_error("fail"); }), std::runtime_error);
+
+    std::atomic<int> ran(0);
+    pool.run([&](int) { ran++; });
+    CHECK(ran == 4);
+}
+
+/* vim: set shiftwidth=4 tabstop=4 softtabstop=4 expandtab: */
@@ -39,6 +39,28 @@ void run_test(int inputs, int outputs, int hidden, int runs, int seed)
     printf("Total time   (s) : %lf\nAverage time (s) : %lf\n",total_time,avg_time);
     //fmt::print("Total time   (s) : {}\n", total_time);
     //fmt::print("Average time (s) : {}\n", avg_time);
+
+    // same population through the bulk generator
+    RandomNetworkParams params;
+    params.n_inputs = inputs;
+    params.n_outputs = outputs;
+    params.n_input_synapses = n_input_synapses;
+    params.n_output_synapses = n_output_synapses;
+    params.n_hidden_synapses = n_hidden_synapses;
+    params.n_hidden_synapses_max = n_hidden_synapses_max;
+
+    rand_start = std::chrono::system_clock::now();
+    std::vector<Network*> nets = make_random_networks(runs, n_neurons, seed, params);
+    rand_end = std::chrono::system_clock::now();
+
+    total_duration = rand_end - rand_start;
+    total_time = total_duration.count();
+    avg_time = total_time / static_cast<double>(runs);
+
+    printf("Bulk total time   (s) : %lf\nBulk average time (s) : %lf\n",total_time,avg_time);
+
+    for(Network *n : nets)
+        delete n;
 }
 
 int main(int argc, char **argv)